@@ -1,6 +1,56 @@
 #include "syscall.h"
+#include "malloc.h"
 #include "stdio.h"
 #include "string.h"
+
+#define CAT_BUF_SIZE 1024
+#define CAT_BUFS 4              // 同时交给内核工作线程的读操作数
+#define CAT_WRITE 0x80000000    // 完成项的 user_data 带此位表示写操作, 其余位为缓冲区下标
+
+// 在提交队列末尾放入一个读写操作, 由下次 uring_enter 提交
+static void queue_rw(struct uring* ring, uint8_t opcode, int fd, char* buf, uint32_t len, uint32_t user_data) {
+   struct uring_sqe* sqe = &ring->sqes[ring->sq_tail & (URING_ENTRIES - 1)];
+   sqe->opcode = opcode;
+   sqe->fd = fd;
+   sqe->addr = (uint32_t)buf;
+   sqe->len = len;
+   sqe->user_data = user_data;
+   ring->sq_tail++;
+}
+
+// 经提交/完成环输出文件: 内核工作线程依次读出后面几块, 本进程同时输出已读到的一块
+// 工作线程按提交顺序执行, 读出的块按顺序完成, 输出也就保持原有顺序; 每块只需一次 uring_enter
+static void cat_uring(struct uring* ring, int fd, char* bufs) {
+   uint32_t idx, inflight = 0;
+   for (idx = 0; idx < CAT_BUFS; idx++) {
+      queue_rw(ring, URING_READ, fd, bufs + idx * CAT_BUF_SIZE, CAT_BUF_SIZE, idx);
+   }
+   int eof = 0;
+   while (ring->sq_head != ring->sq_tail || inflight > 0) {
+      inflight += uring_enter(ring->sq_tail - ring->sq_head, 1);
+      while (ring->cq_head != ring->cq_tail) {
+         struct uring_cqe* cqe = &ring->cqes[ring->cq_head & (URING_CQ_ENTRIES - 1)];
+         uint32_t user_data = cqe->user_data;
+         int32_t res = cqe->res;
+         ring->cq_head++;
+         inflight--;
+         if (user_data & CAT_WRITE) {
+            continue;
+         }
+         if (res <= 0) {   // 读到文件末尾, 其后已提交的读操作也都返回 -1
+            eof = 1;
+            continue;
+         }
+         // 写操作提交时内核已复制数据, 缓冲区马上可以读下一块
+         char* buf = bufs + user_data * CAT_BUF_SIZE;
+         queue_rw(ring, URING_WRITE, 1, buf, res, CAT_WRITE | user_data);
+         if (!eof) {
+            queue_rw(ring, URING_READ, fd, buf, CAT_BUF_SIZE, user_data);
+         }
+      }
+   }
+}
+
 int main(int argc, char** argv) {
    if (argc > 2 || argc == 1) {
       printf("cat: only support 1 argument.\neg: cat filename\n");
@@ -25,14 +75,23 @@ int main(int argc, char** argv) {
       printf("cat: open: open %s failed\n", argv[1]);
       return -1;
    }
-   int read_bytes= 0;
-   while (1) {
-      read_bytes = read(fd, buf, buf_size);
-      if (read_bytes == -1) {
-         break;
+   struct uring* ring = malloc(sizeof(struct uring));
+   char* bufs = malloc(CAT_BUF_SIZE * CAT_BUFS);
+   if (ring != NULL && bufs != NULL && uring_setup(ring, URING_WORKER) == 0) {
+      cat_uring(ring, fd, bufs);
+      uring_setup(NULL, 0);
+   } else {
+      int read_bytes= 0;
+      while (1) {
+         read_bytes = read(fd, buf, buf_size);
+         if (read_bytes == -1) {
+            break;
+         }
+         write(1, buf, read_bytes);
       }
-      write(1, buf, read_bytes);
    }
+   free(bufs);
+   free(ring);
    free(buf);
    close(fd);
    return 66;
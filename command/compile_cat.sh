@@ -17,7 +17,7 @@ CFLAGS="-Wall -c -fno-builtin -W -Wstrict-prototypes \
 LIBS="-I ../lib/ -I ../lib/kernel/ -I ../lib/user/ -I \
       ../kernel/ -I ../device/ -I ../thread/ -I \
       ../userprog/ -I ../fs/ -I ../shell/"
-OBJS="../build/string.o ../build/syscall.o \
+OBJS="../build/string.o ../build/syscall.o ../build/malloc.o \
       ../build/stdio.o ../build/assert.o start.o"
 DD_IN=$BIN
 DD_OUT="../hd60M.img" 
@@ -12,7 +12,7 @@ fi
 BIN="prog_no_arg"
 CFLAGS="-Wall -m32 -c -fno-builtin -fno-stack-protector -W -Wmissing-prototypes -Wno-unused-parameter"
 LIB="../lib/"
-OBJS="../build/string.o ../build/syscall.o ../build/stdio.o ../build/assert.o"
+OBJS="../build/string.o ../build/syscall.o ../build/malloc.o ../build/stdio.o ../build/assert.o"
 DD_IN=$BIN
 DD_OUT="../hd60M.img"
 
@@ -0,0 +1,109 @@
+#include "syscall.h"
+#include "malloc.h"
+#include "stdio.h"
+#include "string.h"
+
+// 检验提交/完成环的用法:
+// uring_test sync   由进程自己执行一批 nop/write/stat/open/lseek/read 操作, 逐项打印完成项
+// uring_test worker 同一批操作交给工作线程执行, 其中 open 应以 -1 完成
+// uring_test exit   交给工作线程一个读标准输入的操作, 不等它完成就退出
+//                   标准输入是键盘时读操作会一直等待, 进程应立即退出, shell 随即给出提示符
+
+// 在提交队列末尾放入一个读写操作, 由下次 uring_enter 提交
+static void queue_rw(struct uring* ring, uint8_t opcode, int fd, char* buf, uint32_t len, uint32_t user_data) {
+   struct uring_sqe* sqe = &ring->sqes[ring->sq_tail & (URING_ENTRIES - 1)];
+   memset(sqe, 0, sizeof(struct uring_sqe));
+   sqe->opcode = opcode;
+   sqe->fd = fd;
+   sqe->addr = (uint32_t)buf;
+   sqe->len = len;
+   sqe->user_data = user_data;
+   ring->sq_tail++;
+}
+
+// 在提交队列末尾放入一个带路径的操作
+static void queue_path(struct uring* ring, uint8_t opcode, const char* path, uint8_t flags, void* addr2, uint32_t user_data) {
+   struct uring_sqe* sqe = &ring->sqes[ring->sq_tail & (URING_ENTRIES - 1)];
+   memset(sqe, 0, sizeof(struct uring_sqe));
+   sqe->opcode = opcode;
+   sqe->flags = flags;
+   sqe->addr = (uint32_t)path;
+   sqe->addr2 = (uint32_t)addr2;
+   sqe->user_data = user_data;
+   ring->sq_tail++;
+}
+
+// 以 flags 登记环, 一次提交一批操作并等全部完成, 按完成顺序打印 user_data 和结果
+// fd 为事先打开的文件, 用来检验 lseek 和 read
+static int run_batch(struct uring* ring, uint32_t flags, int fd) {
+   static const char msg[] = "uring_test: hello from the ring\n";
+   static char rbuf[16];
+   static struct stat st;
+   if (uring_setup(ring, flags) == -1) {
+      printf("uring_test: uring_setup failed\n");
+      return -1;
+   }
+   queue_rw(ring, URING_NOP, 0, NULL, 0, 1);
+   queue_rw(ring, URING_WRITE, 1, (char*)msg, strlen(msg), 2);
+   queue_path(ring, URING_STAT, "/", 0, &st, 3);
+   queue_path(ring, URING_OPEN, "/uring_test", O_RDONLY, NULL, 4);
+   struct uring_sqe* sqe = &ring->sqes[ring->sq_tail & (URING_ENTRIES - 1)];
+   queue_rw(ring, URING_LSEEK, fd, NULL, 0, 5);
+   sqe->flags = SEEK_SET;
+   queue_rw(ring, URING_READ, fd, rbuf, sizeof(rbuf), 6);
+
+   uint32_t cnt = ring->sq_tail - ring->sq_head;
+   int32_t submitted = uring_enter(cnt, cnt);
+   printf("uring_test: %s mode submitted %d\n", flags & URING_WORKER ? "worker" : "sync", submitted);
+   while (ring->cq_head != ring->cq_tail) {
+      struct uring_cqe* cqe = &ring->cqes[ring->cq_head & (URING_CQ_ENTRIES - 1)];
+      printf("   user_data %d res %d\n", cqe->user_data, cqe->res);
+      if (cqe->user_data == 4 && cqe->res >= 0) {
+         close(cqe->res);
+      }
+      ring->cq_head++;
+   }
+   printf("   stat / size %d\n", st.st_size);
+   return uring_setup(NULL, 0);
+}
+
+// 读操作还在工作线程中等待时退出, 由 exit 注销环
+static int exit_inflight(struct uring* ring) {
+   static char buf[16];
+   if (uring_setup(ring, URING_WORKER) == -1) {
+      printf("uring_test: uring_setup failed\n");
+      return -1;
+   }
+   queue_rw(ring, URING_READ, 0, buf, sizeof(buf), 1);
+   printf("uring_test: submitted %d, exiting with the read in flight\n", uring_enter(1, 0));
+   return 0;
+}
+
+int main(int argc, char** argv) {
+   if (argc != 2) {
+      printf("uring_test: usage: uring_test sync|worker|exit\n");
+      return -2;
+   }
+   struct uring* ring = malloc(sizeof(struct uring));
+   if (ring == NULL) {
+      printf("uring_test: malloc memory failed\n");
+      return -1;
+   }
+   if (!strcmp(argv[1], "exit")) {
+      exit(exit_inflight(ring));
+   }
+   if (!strcmp(argv[1], "sync") || !strcmp(argv[1], "worker")) {
+      // 以自身所在的文件检验 lseek 和 read
+      int fd = open("/uring_test", O_RDONLY);
+      if (fd == -1) {
+         printf("uring_test: open /uring_test failed\n");
+         return -1;
+      }
+      int ret = run_batch(ring, argv[1][0] == 'w' ? URING_WORKER : 0, fd);
+      close(fd);
+      free(ring);
+      return ret;
+   }
+   printf("uring_test: unknown case %s\n", argv[1]);
+   return -2;
+}
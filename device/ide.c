@@ -41,6 +41,7 @@
 
 // 定义可读写的最大扇区数,调试用的
 #define max_lba ((80*1024*1024/512) - 1)	// 只支持80MB硬盘
+#define IDE_INTR_TIMEOUT (30 * IRQ0_FREQUENCY)	// 等待硬盘中断的最长嘀嗒数, 30 秒
 
 uint8_t channel_cnt;	   // 按硬盘数计算的通道数
 struct ide_channel channels[2];	 // 有两个ide通道
@@ -132,8 +133,8 @@ static void write2sector(struct disk* hd, void* buf, uint8_t sec_cnt) {
 // 等待 30 秒
 static bool busy_wait(struct disk* hd) {
     struct ide_channel* channel = hd->my_channel;
-    uint16_t time_limit = 30 * 1000; // 可以等待 30000 毫秒
-    while (time_limit -= 10 >= 0) {
+    int32_t time_limit = 30 * 1000; // 可以等待 30000 毫秒
+    while ((time_limit -= 10) >= 0) {
         if (!(inb(reg_status(channel)) & BIT_STAT_BSY)) {
             return (inb(reg_status(channel)) & BIT_STAT_DRQ);
         } else {
@@ -143,6 +144,16 @@ static bool busy_wait(struct disk* hd) {
     return false;
 }
 
+// 阻塞等待硬盘 hd 完成命令后发来的中断, 超时说明硬盘已无响应, 不再无限期地等下去
+static void intr_wait(struct disk* hd, const char* op, uint32_t lba) {
+    struct ide_channel* channel = hd->my_channel;
+    if (!sema_down_timeout(&channel->disk_done, IDE_INTR_TIMEOUT)) {
+        channel->expecting_intr = false;    // 迟到的中断不再唤醒后来的命令
+        char error[64];
+        sprintf(error, "%s %s sector %d timeout!!!!!\n", hd->name, op, lba);
+        PANIC(error);
+    }
+}
 
 // 从硬盘读取 sec_cnt 个扇区到 buf
 void ide_read(struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt) {
@@ -166,7 +177,7 @@ void ide_read(struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt) {
         // 3. 执行的命令写入 reg_cmd 寄存器
         cmd_out(hd->my_channel, CMD_READ_SECTOR); // 准备开始读数据
         // 阻塞自己
-        sema_down(&hd->my_channel->disk_done);
+        intr_wait(hd, "read", lba);
         // 4. 检测硬盘状态是否可读
         if (!busy_wait(hd)) { // 若失败
             char error[64];
@@ -210,7 +221,7 @@ void ide_write(struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt) {
         // 5. 将数据写入硬盘
         write2sector(hd, (void*)((uint32_t)buf+secs_done*512), secs_op);
         // 在硬盘响应期间阻塞自己
-        sema_down(&hd->my_channel->disk_done);
+        intr_wait(hd, "write", lba);
         secs_done += secs_op;
     } 
     // 醒来后开始释放锁
@@ -235,7 +246,7 @@ static void identify_disk(struct disk* hd) {
     select_disk(hd);
     cmd_out(hd->my_channel, CMD_IDENTIFY);
     // 向硬盘发送指令后阻塞自己
-    sema_down(&hd->my_channel->disk_done);
+    intr_wait(hd, "identify", 0);
 
     // 醒来后开始执行下面的代码
     if (!busy_wait(hd)) { // 若失败
@@ -279,6 +290,7 @@ static void partition_scan(struct disk* hd, uint32_t ext_lba) {
             if (ext_lba == 0) { // 此时全是主分区
                 hd->prim_parts[p_no].start_lba = ext_lba + p->start_lba;
                 hd->prim_parts[p_no].sec_cnt = p->sec_cnt;
+                hd->prim_parts[p_no].fs_type = p->fs_type;
                 hd->prim_parts[p_no].my_disk = hd;
                 list_append(&partition_list, &hd->prim_parts[p_no].part_tag);
                 sprintf(hd->prim_parts[p_no].name, "%s%d", hd->name, p_no+1);
@@ -287,6 +299,7 @@ static void partition_scan(struct disk* hd, uint32_t ext_lba) {
             } else {
                 hd->logic_parts[l_no].start_lba = ext_lba + p->start_lba;
                 hd->logic_parts[l_no].sec_cnt = p->sec_cnt;
+                hd->logic_parts[l_no].fs_type = p->fs_type;
                 hd->logic_parts[l_no].my_disk = hd;
                 list_append(&partition_list, &hd->logic_parts[l_no].part_tag);
                 sprintf(hd->logic_parts[l_no].name, "%s%d", hd->name, l_no+5); // 逻辑分区数字是从 5 开始, 主分区是 1~4
@@ -4,10 +4,13 @@
 #include "sync.h"
 #include "bitmap.h"
 
+#define PART_TYPE_SWAP 0x82 // 分区表中交换分区的类型, 这种分区不建文件系统
+
 // 分区结构
 struct partition {
     uint32_t start_lba;         // 起始扇区
     uint32_t sec_cnt;           // 扇区数
+    uint8_t fs_type;            // 分区表中登记的分区类型
     struct disk* my_disk;       // 分区所属的硬盘
     struct list_elem part_tag;  // 用于队列中的标记
     char name[8];               // 分区名称
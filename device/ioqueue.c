@@ -61,6 +61,46 @@ char ioq_getchar(struct ioqueue* ioq) {
     return byte;
 }
 
+// 与 ioq_getchar 相同, 但队列空时若当前任务的等待已被 ioq_cancel 取消则返回 false
+// 成功时字符存入 byte 并返回 true
+bool ioq_getchar_intr(struct ioqueue* ioq, char* byte) {
+    ASSERT(intr_get_status() == INTR_OFF);
+    struct task_struct* cur = running_thread();
+
+    while(ioq_empty(ioq)) {
+        if(cur->io_cancel) {
+            return false;
+        }
+        lock_acquire(&ioq->lock);
+        // 可能在锁上等了别的消费者很久, 拿到锁后要再看一次是否已被取消
+        if(cur->io_cancel) {
+            lock_release(&ioq->lock);
+            return false;
+        }
+        ioq_wait(&ioq->consumer);
+        lock_release(&ioq->lock);
+    }
+
+    *byte = ioq->buf[ioq->tail];
+    ioq->tail = next_pos(ioq->tail);
+
+    if(ioq->producer != NULL) {
+        wakeup(&ioq->producer);
+    }
+    return true;
+}
+
+// 取消 pthread 在 ioq 上的读等待, 此后它在 ioq_getchar_intr 中遇到队列空就直接返回
+// pthread 正等在 ioq 上时将其唤醒
+void ioq_cancel(struct ioqueue* ioq, struct task_struct* pthread) {
+    enum intr_status old_status = intr_disable();
+    pthread->io_cancel = true;
+    if(ioq->consumer == pthread) {
+        wakeup(&ioq->consumer);
+    }
+    intr_set_status(old_status);
+}
+
 // 生产者往 ioq 队列中写入一个字符 byte
 void ioq_putchar(struct ioqueue* ioq, char byte) {
     ASSERT(intr_get_status() == INTR_OFF);
@@ -21,5 +21,7 @@ void ioqueue_init(struct ioqueue* ioq);
 bool ioq_full(struct ioqueue* ioq);
 bool ioq_empty(struct ioqueue* ioq);
 char ioq_getchar(struct ioqueue* ioq);
+bool ioq_getchar_intr(struct ioqueue* ioq, char* byte);
+void ioq_cancel(struct ioqueue* ioq, struct task_struct* pthread);
 void ioq_putchar(struct ioqueue* ioq, char byte);
 #endif
\ No newline at end of file
@@ -4,19 +4,56 @@
 #include "thread.h"
 #include "debug.h"
 #include "interrupt.h"
+#include "stdio-kernel.h"
+#include "vdata.h"
 
-#define IRQ0_FREQUENCY 		100
 #define INPUT_FREQUENCY 	1193180
-#define COUNTER0_VALUE 		INPUT_FREQUENCY / IRQ0_FREQUENCY
+#define COUNTER0_VALUE 		(INPUT_FREQUENCY / IRQ0_FREQUENCY)
 #define COUNTER0_PORT 		0x40
 #define COUNTER0_NO		0
 #define COUNTER_MODE		2
+#define ONESHOT_MODE		0	// 计数到 0 时触发一次中断
 #define READ_WRITE_LATCH	3
 #define PIT_CONTROL_PORT	0x43
 #define mil_seconds_per_intr (1000 / IRQ0_FREQUENCY)
+#define ONESHOT_MAX_TICKS	(0xffff / COUNTER0_VALUE)	// 单次触发最多能推迟的嘀嗒数
 
 uint32_t ticks; // ticks 是内核自中断开启以来总共的嘀嗒数
 
+// 无节拍: 空闲或只有一个任务可运行时, 把计数器 0 改为单次触发, 推迟到下一个真正要做事的嘀嗒
+// 计数器的初值只有 16 位, 一次最多推迟 ONESHOT_MAX_TICKS 个嘀嗒; 中断到来后补记跳过的嘀嗒, 恢复周期模式
+// 单次触发期间有任务就绪或新加定时器时, 改为在下一个嘀嗒的边界触发, 嘀嗒数不会因此漂移
+static bool pit_oneshot;        // 计数器 0 当前是否为单次触发
+static uint32_t oneshot_ticks;  // 单次触发到期时共经过的嘀嗒数
+static uint32_t timer_irqs;     // 时钟中断的次数
+static uint32_t oneshot_irqs;   // 其中单次触发的次数
+static uint32_t stat_ticks, stat_irqs;  // 上次查看统计时的嘀嗒数与中断次数
+
+// 高精度时钟: 开机时用 PIT 计数器 2 定出 TSC 的频率, 之后 TSC 的差值按 ns = cycles * tsc_mult >> VDATA_TSC_SHIFT 换算
+// 取 24 位定点, TSC 频率在 4MHz 以上时 tsc_mult 放得进 32 位, 换算只需两次 32x32 位乘法
+// 时钟参数放在共享数据页中, 用户程序读时钟也不必陷入内核
+#define CALIBRATE_MS 50                     // 校准时计数器 2 计时的毫秒数
+#define PIT2_PORT 0x42
+#define PIT2_GATE_PORT 0x61                 // 第 0 位为计数器 2 的门控, 第 1 位为扬声器, 第 5 位为计数器 2 的输出
+static uint32_t tsc_khz;                    // TSC 的频率
+
+// 分层时间轮: 最低层 tv1 每槽一个嘀嗒, 其上三层每槽分别覆盖 2^8、2^14、2^20 个嘀嗒
+// 定时器按剩余时间放入能容纳它的最低层, 最低层转完一圈时把上一层当前槽中的定时器重新安放到下层
+// 加入、取消定时器都是 O(1), 每个嘀嗒只处理 tv1 的一个槽
+#define TVR_BITS 8
+#define TVN_BITS 6
+#define TVR_SIZE (1 << TVR_BITS)
+#define TVN_SIZE (1 << TVN_BITS)
+#define TVR_MASK (TVR_SIZE - 1)
+#define TVN_MASK (TVN_SIZE - 1)
+#define TVN_LEVELS 3                                        // tv1 之上的层数
+#define WHEEL_SPAN (1u << (TVR_BITS + TVN_LEVELS * TVN_BITS)) // 时间轮直接容纳的最大间隔
+#define KTIMER_MAX_DELAY 0x7fffffff                         // 更长的间隔会与嘀嗒数的回绕混淆
+
+static struct list tv1[TVR_SIZE];
+static struct list tvn[TVN_LEVELS][TVN_SIZE];
+static uint32_t wheel_clock;    // 时间轮下一个要处理的嘀嗒数
+
 
 /*把操作的计数器counter_no、读写锁属性rwl、计数器模式counter_mode写入模式控制寄存器井赋予初始值counter_value*/ 
 static void frequency_set(uint8_t counter_port,
@@ -30,33 +67,246 @@ static void frequency_set(uint8_t counter_port,
 	//先写入低8位
 	outb(counter_port, (uint8_t)counter_value); 
 	//再写入高8位
-	outb(counter_port, (uint8_t)counter_value >> 8);
+	outb(counter_port, (uint8_t)(counter_value >> 8));
 }	
 
 
+// 让计数器 2 以方式 0 计时 CALIBRATE_MS 毫秒, 用其间经过的 TSC 周期数定出 TSC 的频率
+static void tsc_calibrate(void) {
+    uint32_t latch = INPUT_FREQUENCY / 1000 * CALIBRATE_MS;
+    // 打开计数器 2 的门控, 关掉扬声器
+    outb(PIT2_GATE_PORT, (inb(PIT2_GATE_PORT) & ~0x02) | 0x01);
+    outb(PIT_CONTROL_PORT, 2 << 6 | READ_WRITE_LATCH << 4 | ONESHOT_MODE << 1);
+    outb(PIT2_PORT, (uint8_t)latch);
+    outb(PIT2_PORT, (uint8_t)(latch >> 8));
+    uint64_t start = rdtsc();
+    while (!(inb(PIT2_GATE_PORT) & 0x20)) {
+    }
+    vdata->tsc_base = rdtsc();
+    vdata->ns_per_tick = 1000000000 / IRQ0_FREQUENCY;
+    tsc_khz = (uint32_t)div64(vdata->tsc_base - start, CALIBRATE_MS, NULL);
+    if (tsc_khz >= 4000) {
+        vdata->tsc_mult = (uint32_t)div64((uint64_t)1000000 << VDATA_TSC_SHIFT, tsc_khz, NULL);
+    }
+}
+
+// 开机以来的单调时间, 单位为纳秒; TSC 不可用时退回以嘀嗒计
+uint64_t ktime_ns(void) {
+    return vdata_clock_ns(vdata);
+}
+
+// 把 clock_id 指定的时钟的当前时间存入 tp, 目前只有开机以来的单调时钟, 成功返回 0
+// 用户库的 clock_gettime 直接读共享数据页, 不走这个系统调用
+int32_t sys_clock_gettime(int32_t clock_id, struct timespec* tp) {
+    if (clock_id != CLOCK_MONOTONIC || tp == NULL) {
+        return -1;
+    }
+    uint32_t nsec;
+    uint64_t sec = div64(ktime_ns(), 1000000000, &nsec);
+    tp->tv_sec = (int32_t)sec;
+    tp->tv_nsec = nsec;
+    return 0;
+}
+
+// 按到期时间把 timer 放入时间轮的槽中, 需关中断调用
+static void wheel_insert(struct ktimer* timer) {
+    uint32_t expires = timer->expires;
+    uint32_t delta = expires - wheel_clock;
+    struct list* slot;
+    if ((int32_t)delta < 0) {
+        slot = &tv1[wheel_clock & TVR_MASK];    // 已经到期, 放在下一个要处理的槽
+    } else if (delta < TVR_SIZE) {
+        slot = &tv1[expires & TVR_MASK];
+    } else {
+        // 超出时间轮范围的先放在最高层最远的槽, 转到那里时再重新安放
+        if (delta >= WHEEL_SPAN) {
+            delta = WHEEL_SPAN - 1;
+            expires = wheel_clock + delta;
+        }
+        uint32_t level = 0, shift = TVR_BITS;
+        while (delta >= 1u << (shift + TVN_BITS)) {
+            level++;
+            shift += TVN_BITS;
+        }
+        slot = &tvn[level][(expires >> shift) & TVN_MASK];
+    }
+    list_append(slot, &timer->tag);
+}
+
+// 处理时间轮中到 ticks 为止到期的定时器, 在时钟中断中调用
+static void wheel_run(void) {
+    while ((int32_t)(ticks - wheel_clock) >= 0) {
+        uint32_t idx = wheel_clock & TVR_MASK;
+        // tv1 转完一圈, 把上层当前槽中的定时器重新安放; 上层也转完一圈时继续级联
+        uint32_t level = 0;
+        while (idx == 0 && level < TVN_LEVELS) {
+            uint32_t slot_idx = (wheel_clock >> (TVR_BITS + level * TVN_BITS)) & TVN_MASK;
+            struct list* slot = &tvn[level][slot_idx];
+            while (!list_empty(slot)) {
+                wheel_insert(elem2entry(struct ktimer, tag, list_pop(slot)));
+            }
+            if (slot_idx != 0) {
+                break;
+            }
+            level++;
+        }
+        wheel_clock++;
+        struct list* slot = &tv1[idx];
+        while (!list_empty(slot)) {
+            struct ktimer* timer = elem2entry(struct ktimer, tag, list_pop(slot));
+            timer->pending = false;
+            timer->func(timer->arg);
+        }
+    }
+}
+
+// 从下一个嘀嗒算起, 时间轮最早在第几个嘀嗒有定时器到期或需要级联, 最多看 limit 个嘀嗒
+static uint32_t wheel_next(uint32_t limit) {
+    uint32_t n = 1;
+    while (n < limit) {
+        uint32_t clock = wheel_clock + n - 1;
+        if ((clock & TVR_MASK) == 0 || !list_empty(&tv1[clock & TVR_MASK])) {
+            break;
+        }
+        n++;
+    }
+    return n;
+}
+
+// 把计数器 0 改为单次触发, 最多推迟 budget 个嘀嗒, 还要在时间轮下一次有事要做时触发, 需关中断调用
+// 已经是单次触发或只能推迟一个嘀嗒时保持不变
+void timer_oneshot(uint32_t budget) {
+    if (pit_oneshot) {
+        return;
+    }
+    uint32_t n = wheel_next(budget < ONESHOT_MAX_TICKS ? budget : ONESHOT_MAX_TICKS);
+    if (n <= 1) {
+        return;
+    }
+    frequency_set(COUNTER0_PORT, COUNTER0_NO, READ_WRITE_LATCH, ONESHOT_MODE, n * COUNTER0_VALUE);
+    pit_oneshot = true;
+    oneshot_ticks = n;
+}
+
+// 单次触发期间需要恢复节拍时调用, 改为在下一个嘀嗒的边界触发, 需关中断调用
+// 已经过的完整嘀嗒先补记到 ticks 中, 调用者随后按 ticks 计算到期时间不会提前
+void timer_periodic(void) {
+    if (!pit_oneshot) {
+        return;
+    }
+    // 锁存计数器 0 的当前值, 先读低 8 位再读高 8 位
+    outb(PIT_CONTROL_PORT, COUNTER0_NO << 6);
+    uint32_t left = inb(COUNTER0_PORT);
+    left |= inb(COUNTER0_PORT) << 8;
+    uint32_t total = oneshot_ticks * COUNTER0_VALUE;
+    bool fired = left == 0 || left > total;    // 已经计数到 0, 中断马上就到
+    uint32_t passed = fired ? oneshot_ticks - 1 : (total - left) / COUNTER0_VALUE;  // 已经过的完整嘀嗒数
+    if (passed > 0) {
+        running_thread()->elapsed_ticks += passed;
+        ticks += passed;
+        vdata->ticks = ticks;
+        oneshot_ticks -= passed;    // 中断到来时只再补记剩下的嘀嗒
+    }
+    if (fired || oneshot_ticks == 1) {
+        return;     // 本来就在下一个边界触发
+    }
+    frequency_set(COUNTER0_PORT, COUNTER0_NO, READ_WRITE_LATCH, ONESHOT_MODE, \
+                  left - (oneshot_ticks - 1) * COUNTER0_VALUE);
+    oneshot_ticks = 1;
+}
+
+// 向标准输出写出时钟中断的统计, 对比经过的嘀嗒数与实际的中断次数, 看出无节拍省下的中断
+void sys_timerstat(void) {
+    enum intr_status old_status = intr_disable();
+    uint32_t now_ticks = ticks, now_irqs = timer_irqs, oneshots = oneshot_irqs;
+    uint32_t delta_ticks = now_ticks - stat_ticks, delta_irqs = now_irqs - stat_irqs;
+    stat_ticks = now_ticks;
+    stat_irqs = now_irqs;
+    intr_set_status(old_status);
+    if (vdata->tsc_mult != 0) {
+        printk_stdout("clocksource: tsc %d kHz\n", tsc_khz);
+    } else {
+        printk_stdout("clocksource: pit %d Hz\n", IRQ0_FREQUENCY);
+    }
+    printk_stdout("total: %d ticks  %d timer interrupts  %d one-shot  %d%% saved\n", now_ticks, now_irqs, oneshots, \
+                  now_ticks == 0 ? 0 : (now_ticks - now_irqs) * 100 / now_ticks);
+    printk_stdout("since last: %d ticks  %d timer interrupts  %d/s\n", delta_ticks, delta_irqs, \
+                  delta_ticks == 0 ? 0 : delta_irqs * IRQ0_FREQUENCY / delta_ticks);
+}
+
+// 初始化定时器 timer, 到期时调用 func(arg)
+void ktimer_init(struct ktimer* timer, ktimer_func* func, void* arg) {
+    timer->func = func;
+    timer->arg = arg;
+    timer->pending = false;
+}
+
+// 启动定时器 timer, delay 个嘀嗒后到期, timer 须尚未启动
+void ktimer_add(struct ktimer* timer, uint32_t delay) {
+    enum intr_status old_status = intr_disable();
+    ASSERT(!timer->pending);
+    if (delay > KTIMER_MAX_DELAY) {
+        delay = KTIMER_MAX_DELAY;
+    }
+    timer_periodic();   // 单次触发可能推迟到新定时器到期之后, 先恢复节拍并补记已过的嘀嗒
+    timer->expires = ticks + delay;
+    timer->pending = true;
+    wheel_insert(timer);
+    intr_set_status(old_status);
+}
+
+// 取消尚未到期的定时器 timer, 返回它是否还在等待到期
+bool ktimer_cancel(struct ktimer* timer) {
+    enum intr_status old_status = intr_disable();
+    bool pending = timer->pending;
+    if (pending) {
+        list_remove(&timer->tag);
+        timer->pending = false;
+    }
+    intr_set_status(old_status);
+    return pending;
+}
+
 // 时钟的中断处理函数
 static void intr_timer_handler(void) {
     struct task_struct* cur_thread = running_thread();//获取当前正在运行的线程
 
     ASSERT(cur_thread->stack_magic == 0x19870916); // 检查栈是否溢出
 
-    cur_thread->elapsed_ticks++; // 记录此线程占用的 cpu 时间
-    ticks++; // 内核态和用户态总共的嘀嗒数
-    
-    if(cur_thread->ticks == 0) {
-        // 若进程时间片用完, 就开始调度新的进程上 cpu
-        schedule();
-    } else {
-        cur_thread->ticks--;
+    // 单次触发的中断补记期间跳过的嘀嗒, 并恢复周期模式
+    uint32_t elapsed = 1;
+    if (pit_oneshot) {
+        elapsed = oneshot_ticks;
+        pit_oneshot = false;
+        frequency_set(COUNTER0_PORT, COUNTER0_NO, READ_WRITE_LATCH, COUNTER_MODE, COUNTER0_VALUE);
+        oneshot_irqs++;
     }
+    timer_irqs++;
+    cur_thread->elapsed_ticks += elapsed; // 记录此线程占用的 cpu 时间
+    ticks += elapsed; // 内核态和用户态总共的嘀嗒数
+    vdata->ticks = ticks;
+
+    // 先处理到期的定时器, 被唤醒的任务级别更高时可以马上抢占
+    wheel_run();
+    // 时间片用完或有更高级别的任务就绪时, 调度新的任务上 cpu
+    thread_tick(cur_thread, elapsed);
+    // 没有别的任务等着运行时, 下一个中断推迟到真正要做事的时候
+    timer_oneshot(thread_tick_budget(running_thread()));
+}
+// 睡眠到期, 唤醒睡眠的任务
+static void sleep_expire(void* arg) {
+   thread_unblock((struct task_struct*)arg);
 }
+
 // 以 tick 为单位的 sleep, 任何时间形式的 sleep 会转换此 ticks 形式
-static void ticks_to_sleep(uint32_t sleep_ticks) {
-   uint32_t start_tick = ticks;
-   // 若间隔的 ticks 数不够便让出 cpu
-   while (ticks - start_tick < sleep_ticks) {
-      thread_yield();
-   }
+// 睡眠期间任务阻塞, 不再被调度, 由时间轮中的定时器到期时唤醒
+void ticks_to_sleep(uint32_t sleep_ticks) {
+   struct ktimer timer;
+   ktimer_init(&timer, sleep_expire, running_thread());
+   enum intr_status old_status = intr_disable();
+   ktimer_add(&timer, sleep_ticks);
+   thread_block(TASK_BLOCKED);
+   intr_set_status(old_status);
 }
 
 // 以毫秒为单位的 sleep
@@ -65,11 +315,42 @@ void mtime_sleep(uint32_t m_seconds) {
    ASSERT(sleep_ticks > 0);
    ticks_to_sleep(sleep_ticks);
 }
+
+// 睡眠 req 指定的时间, 精度为一个嘀嗒, 不足一个嘀嗒的部分向上取整
+// 睡眠不会被打断, rem 不为 NULL 时置为 0; req 不合法时返回 -1
+int32_t sys_nanosleep(const struct timespec* req, struct timespec* rem) {
+   if (req == NULL || req->tv_sec < 0 || req->tv_nsec < 0 || req->tv_nsec >= 1000000000) {
+      return -1;
+   }
+   uint32_t ns_per_tick = 1000000000 / IRQ0_FREQUENCY;
+   uint32_t sleep_ticks = KTIMER_MAX_DELAY;
+   if ((uint32_t)req->tv_sec < KTIMER_MAX_DELAY / IRQ0_FREQUENCY) {
+      sleep_ticks = req->tv_sec * IRQ0_FREQUENCY + DIV_ROUND_UP((uint32_t)req->tv_nsec, ns_per_tick);
+   }
+   if (sleep_ticks == 0) {
+      thread_yield();
+   } else {
+      ticks_to_sleep(sleep_ticks);
+   }
+   if (rem != NULL) {
+      rem->tv_sec = rem->tv_nsec = 0;
+   }
+   return 0;
+}
 // 初始化 PIT8253
 void timer_init() {
     put_str("timer_init start\n");
     // 设置 8253 的定时周期
     frequency_set(COUNTER0_PORT, COUNTER0_NO, READ_WRITE_LATCH, COUNTER_MODE, COUNTER0_VALUE);
+    uint32_t idx;
+    for (idx = 0; idx < TVR_SIZE; idx++) {
+        list_init(&tv1[idx]);
+    }
+    for (idx = 0; idx < TVN_LEVELS * TVN_SIZE; idx++) {
+        list_init(&tvn[idx / TVN_SIZE][idx % TVN_SIZE]);
+    }
+    wheel_clock = ticks;
+    tsc_calibrate();
     register_handler(0x20, intr_timer_handler);
     put_str("timer_init donw\n");
 }
\ No newline at end of file
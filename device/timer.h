@@ -1,7 +1,40 @@
 #ifndef __DEVICE_TIME_H
 #define __DEVICE_TIME_H
 #include "stdint.h"
+#include "global.h"
+#include "list.h"
+
+#define IRQ0_FREQUENCY 100      // 时钟中断的频率, 即每秒的嘀嗒数
+#define CLOCK_MONOTONIC 1       // clock_gettime 的时钟: 开机以来的单调时间
+
+typedef void ktimer_func(void*);
+
+// 一次性内核定时器, 到期时在时钟中断中以关中断的状态调用 func(arg)
+struct ktimer {
+    struct list_elem tag;   // 用于加入时间轮的槽
+    uint32_t expires;       // 到期时的嘀嗒数
+    ktimer_func* func;
+    void* arg;
+    bool pending;           // 是否已加入时间轮且尚未到期
+};
+
+// nanosleep 与 clock_gettime 使用的时间
+struct timespec {
+    int32_t tv_sec;
+    int32_t tv_nsec;
+};
+
+extern uint32_t ticks;
 void timer_init(void);
+void timer_oneshot(uint32_t budget);
+void timer_periodic(void);
+void sys_timerstat(void);
+uint64_t ktime_ns(void);
+int32_t sys_clock_gettime(int32_t clock_id, struct timespec* tp);
+void ktimer_init(struct ktimer* timer, ktimer_func* func, void* arg);
+void ktimer_add(struct ktimer* timer, uint32_t delay);
+bool ktimer_cancel(struct ktimer* timer);
+void ticks_to_sleep(uint32_t sleep_ticks);
 void mtime_sleep(uint32_t m_seconds);
+int32_t sys_nanosleep(const struct timespec* req, struct timespec* rem);
 #endif
-
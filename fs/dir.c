@@ -10,6 +10,7 @@
 #include "string.h"
 #include "interrupt.h"
 #include "super_block.h"
+#include "slab.h"
 
 struct dir root_dir; // 根目录
 
@@ -21,7 +22,7 @@ void open_root_dir(struct partition* part) {
 
 // 在分区 part 上打开 inode 为 inode_no 的目录并返回目录指针
 struct dir* dir_open(struct partition* part, uint32_t inode_no) {
-    struct dir* pdir = (struct dir*)sys_malloc(sizeof(struct dir));
+    struct dir* pdir = (struct dir*)kmem_cache_alloc(dir_cache);
     pdir->inode = inode_open(part, inode_no);
     pdir->dir_pos = 0;
     return pdir;
@@ -50,7 +51,7 @@ bool search_dir_entry(struct partition* part, struct dir* pdir, const char* name
     }
     // 至此, all_blocks 存储的是该文件或目录的所有扇区地址
 
-    uint8_t* buf = (uint8_t*)sys_malloc(SECTOR_SIZE);
+    uint8_t* buf = (uint8_t*)kmem_cache_alloc(io_buf_cache);
     // p_de 为指向目录项的指针, 值为 buf 起始地址
     struct dir_entry* p_de = (struct dir_entry*)buf;
     uint32_t dir_entry_size = part->sb->dir_entry_size;
@@ -72,7 +73,7 @@ bool search_dir_entry(struct partition* part, struct dir* pdir, const char* name
             // 若找到了, 就直接复制整个目录项
             if (!strcmp(p_de->filename, name)) {
                 memcpy(dir_e, p_de, dir_entry_size);
-                sys_free(buf);
+                kmem_cache_free(io_buf_cache, buf);
                 sys_free(all_blocks);
                 return true;
             }
@@ -83,7 +84,7 @@ bool search_dir_entry(struct partition* part, struct dir* pdir, const char* name
         p_de = (struct dir_entry*)buf;
         memset(buf, 0, SECTOR_SIZE);
     }
-    sys_free(buf);
+    kmem_cache_free(io_buf_cache, buf);
     sys_free(all_blocks);
     return false;
 }
@@ -95,7 +96,7 @@ void dir_close(struct dir* dir) {
         return;
     }
     inode_close(dir->inode);
-    sys_free(dir);
+    kmem_cache_free(dir_cache, dir);
 }
 
 // 在内存中初始化目录项
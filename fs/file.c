@@ -10,6 +10,7 @@
 #include "super_block.h"
 #include "thread.h"
 #include "dir.h"
+#include "slab.h"
 
 // 文件表
 struct file file_table[MAX_FILE_OPEN];
@@ -30,10 +31,16 @@ int32_t get_free_slot_in_global(void) {
     return fd_idx;
 }
 
+// 返回文件描述符表所属的任务, uring 工作线程代宿主进程执行文件操作, 用的是宿主进程的表
+struct task_struct* fd_owner(void) {
+    struct task_struct* cur = running_thread();
+    return cur->host != NULL ? cur->host : cur;
+}
+
 // 将全局描述符下标安装到进程或线程自己的文件描述符 fd_table 中
 // 成功则返回下标，失败则返回 -1
 int32_t pcb_fd_install(int32_t global_fd_idx) {
-    struct task_struct* cur = running_thread();
+    struct task_struct* cur = fd_owner();
     uint8_t local_fd_idx = 3;
     while (local_fd_idx < MAX_FILES_OPEN_PER_PROC) {
         if (cur->fd_table[local_fd_idx] == -1) {
@@ -112,9 +119,9 @@ int32_t file_create(struct dir* parent_dir, char* filename, uint8_t flag) {
         return -1;       
     }
 
-    // 因此 inode 要从堆中申请内存，不可生成局部变量
+    // 因此 inode 要从 inode_cache 中申请内存，不可生成局部变量
     // 因为 file_table 数组中的文件描述符的 inode 要指向它
-    struct inode* new_file_inode = (struct inode*)sys_malloc(sizeof(struct inode));
+    struct inode* new_file_inode = (struct inode*)kmem_cache_alloc(inode_cache);
     if (new_file_inode == NULL) {
         printk("file_create: sys_malloc for inode failded\n");
         rollback_step = 1;
@@ -173,7 +180,7 @@ rollback:
             // 失败时，将 file_table 中的相应位清空
             memset(&file_table[fd_idx], 0, sizeof(struct file));
         case 2:
-            sys_free(new_file_inode);
+            kmem_cache_free(inode_cache, new_file_inode);
         case 1:
             // 如果新文件的 i 结点创建失败，之前位图中分配的 inode_no 也要恢复
             bitmap_set(&cur_part->inode_bitmap, inode_no, 0);
@@ -228,7 +235,7 @@ int32_t file_write(struct file* file, const void* buf, uint32_t count) {
         printk("exceed max file_size 71680 bytes, write file failed\n");
         return -1;
     }
-    uint8_t* io_buf = sys_malloc(BLOCK_SIZE);
+    uint8_t* io_buf = kmem_cache_alloc(io_buf_cache);
     if (io_buf == NULL) {
         printk("file_write: sys_malloc for io_buf failed\n");
         return -1;
@@ -408,7 +415,7 @@ int32_t file_write(struct file* file, const void* buf, uint32_t count) {
     }
     inode_sync(cur_part, file->fd_inode, io_buf);
     sys_free(all_blocks);
-    sys_free(io_buf);
+    kmem_cache_free(io_buf_cache, io_buf);
     return bytes_written;
 }
 
@@ -426,7 +433,7 @@ int32_t file_read(struct file* file, void* buf, uint32_t count) {
         }
     }
 
-    uint8_t* io_buf = sys_malloc(BLOCK_SIZE);
+    uint8_t* io_buf = kmem_cache_alloc(io_buf_cache);
     if (io_buf == NULL) {
         printk("file_read: sys_malloc for io_buf failed\n");
     }
@@ -501,6 +508,6 @@ int32_t file_read(struct file* file, void* buf, uint32_t count) {
         size_left -= chunk_size;
     }
     sys_free(all_blocks);
-    sys_free(io_buf);
+    kmem_cache_free(io_buf_cache, io_buf);
     return bytes_read;
 }
\ No newline at end of file
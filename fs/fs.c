@@ -14,8 +14,13 @@
 #include "console.h"
 #include "keyboard.h"
 #include "ioqueue.h"
+#include "slab.h"
+#include "uring.h"
 
 struct partition* cur_part; // 默认情况下操作的分区
+struct kmem_cache* inode_cache;     // 已打开的 inode
+struct kmem_cache* dir_cache;       // 已打开的目录
+struct kmem_cache* io_buf_cache;    // 一个扇区大小的读写缓冲区
 
 // 在分区链表中找到名为 part_name 的分区，并将其指针赋值给 cur_part
 static bool mount_partition(struct list_elem* pelem, int arg) {
@@ -185,6 +190,14 @@ static void partition_format(struct partition* part) {
 void filesys_init() {
     uint8_t channel_no = 0, dev_no, part_idx = 0;
 
+    // 文件系统中频繁申请释放的对象都从各自的缓存中分配
+    inode_cache = kmem_cache_create("inode", sizeof(struct inode), 0, NULL);
+    dir_cache = kmem_cache_create("dir", sizeof(struct dir), 0, NULL);
+    io_buf_cache = kmem_cache_create("io_buf", SECTOR_SIZE, 0, NULL);
+    if (inode_cache == NULL || dir_cache == NULL || io_buf_cache == NULL) {
+        PANIC("create fs caches failed");
+    }
+
     // sb_buf 用来存储从硬盘上读入的超级块
     struct super_block* sb_buf = (struct super_block*)sys_malloc(SECTOR_SIZE);
 
@@ -205,7 +218,9 @@ void filesys_init() {
                 if (part_idx == 4) {    // 开始处理逻辑分区
                     part = hd->logic_parts;
                 }
-                if (part->sec_cnt != 0) {   // 如果分区存在
+                if (part->sec_cnt != 0 && part->fs_type == PART_TYPE_SWAP) {
+                    printk("%s is swap partition\n", part->name); // 交换分区由 swap_init 使用, 不能格式化
+                } else if (part->sec_cnt != 0) {   // 如果分区存在
                     memset(sb_buf, 0, SECTOR_SIZE);
                     // 读出分区的超级块，根据魔数是否正确来判度胺是否存在文件系统
                     ide_read(hd, part->start_lba+1, sb_buf, 1);
@@ -413,7 +428,7 @@ int32_t sys_open(const char* pathname, uint8_t flags) {
 
 // 将文件描述符转化为文件表的下标
 uint32_t fd_local2global(uint32_t local_fd) {
-    struct task_struct* cur = running_thread();
+    struct task_struct* cur = fd_owner();
     int32_t global_fd = cur->fd_table[local_fd];
     ASSERT(global_fd >= 0 && global_fd < MAX_FILE_OPEN);
     return (uint32_t)global_fd;
@@ -423,6 +438,11 @@ uint32_t fd_local2global(uint32_t local_fd) {
 int32_t sys_close(int32_t fd) {
     int32_t ret = -1;
     if (fd > 2) {
+        // uring 工作线程可能正在用这个文件, 等它做完当前操作
+        struct lock* fd_lock = uring_fd_lock(running_thread());
+        if (fd_lock != NULL) {
+            lock_acquire(fd_lock);
+        }
         uint32_t global_fd = fd_local2global(fd);
         if (is_pipe(fd)) {
             // 如果此管道上的描述符都被关闭，释放管道的环形缓冲区
@@ -434,7 +454,10 @@ int32_t sys_close(int32_t fd) {
         } else {
             ret = file_close(&file_table[global_fd]);
         } 
-        running_thread()->fd_table[fd] = -1;    //使该文件描述符位可用
+        fd_owner()->fd_table[fd] = -1;    //使该文件描述符位可用
+        if (fd_lock != NULL) {
+            lock_release(fd_lock);
+        }
     }
     return ret;
 }
@@ -450,9 +473,18 @@ int32_t sys_write(int32_t fd, const void* buf, uint32_t count) {
         if (is_pipe(fd)) {
 	        return pipe_write(fd, buf, count);
         } else {
-	        char tmp_buf[1024] = {0};
-	        memcpy(tmp_buf, buf, count);
-	        console_put_str(tmp_buf);
+	        // 按缓冲区大小分段输出, 每段末尾留一个字节放结束符
+	        char tmp_buf[1024];
+	        const char* src = buf;
+	        uint32_t left = count;
+	        while (left > 0) {
+	            uint32_t len = left < sizeof(tmp_buf) - 1 ? left : sizeof(tmp_buf) - 1;
+	            memcpy(tmp_buf, src, len);
+	            tmp_buf[len] = 0;
+	            console_put_str(tmp_buf);
+	            src += len;
+	            left -= len;
+	        }
 	        return count;
         }
     } else if (is_pipe(fd)) {	    /* 若是管道就调用管道的方法 */
@@ -485,7 +517,10 @@ int32_t sys_read(int32_t fd, void* buf, uint32_t count) {
             char* buffer = buf;
             uint32_t bytes_read = 0;
             while (bytes_read < count) {
-                *buffer = ioq_getchar(&kbd_buf);
+                // 等待被取消时只返回已读到的部分
+                if (!ioq_getchar_intr(&kbd_buf, buffer)) {
+                    break;
+                }
                 bytes_read++;
                 buffer++;
             }
@@ -835,7 +870,7 @@ static int get_child_dir_name(uint32_t p_inode_nr, uint32_t c_inode_nr, char* pa
 // 失败则返回 NULL
 char* sys_getcwd(char* buf, uint32_t size) {
     ASSERT(buf != NULL);
-    void* io_buf = sys_malloc(SECTOR_SIZE);
+    void* io_buf = kmem_cache_alloc(io_buf_cache);
     if (io_buf == NULL) {
         return NULL;
     }
@@ -859,7 +894,7 @@ char* sys_getcwd(char* buf, uint32_t size) {
     while (child_inode_nr) {
         parent_inode_nr = get_parent_dir_inode_nr(child_inode_nr, io_buf);
         if (get_child_dir_name(parent_inode_nr, child_inode_nr, full_path_reverse, io_buf) == -1) {
-            sys_free(io_buf);
+            kmem_cache_free(io_buf_cache, io_buf);
             return NULL;
         }
         child_inode_nr = parent_inode_nr;
@@ -873,7 +908,7 @@ char* sys_getcwd(char* buf, uint32_t size) {
         // 在 full_path_reverse 中添加结束字符串，作为下一次执行 strcpy 中 last_slash 的边界
         *last_slash = 0;
     }
-    sys_free(io_buf);
+    kmem_cache_free(io_buf_cache, io_buf);
     return buf;
 }
 
@@ -933,6 +968,12 @@ void sys_help(void) {
        rm: remove a regular file\n\
        pwd: show current work directory\n\
        ps: show process information\n\
+       meminfo: show memory pool and malloc statistics\n\
+       slabinfo: show kernel object cache statistics\n\
+       cswbench: measure context switch cost\n\
+       zram [pages]: show or set the compressed swap cap\n\
+       timerstat: show timer interrupt statistics\n\
+       sysbench: compare int 0x80 and sysenter syscall latency\n\
        clear: clear screen\n\
     shortcut key:\n\
        ctrl+l: clear screen\n\
@@ -9,6 +9,7 @@
 #include "stdio-kernel.h"
 #include "string.h"
 #include "super_block.h"
+#include "slab.h"
 
 // 用来存储 inode 位置
 struct inode_position {
@@ -98,14 +99,8 @@ struct inode* inode_open(struct partition* part, uint32_t inode_no) {
     // inode 位置信息会存入 inode_pos，包括 inode 所在扇区地址和扇区内字节偏移量。
     inode_locate(part, inode_no, &inode_pos);
 
-    // 为使通过 sys_malloc 创建的新 inode 被所有任务共享，需要将 inode 置于内核空间，故需要临时将 cur_pbc->pgdir 置为 NULL
-    struct task_struct* cur = running_thread();
-    uint32_t* cur_pagedir_bak = cur->pgdir;
-    cur->pgdir = NULL;
-    // 以上三行代码完成后下面分配的内存将位于内核区
-    inode_found = (struct inode*)sys_malloc(sizeof(struct inode));
-    // 恢复 pgdir
-    cur->pgdir = cur_pagedir_bak;
+    // inode 要被所有任务共享，从位于内核空间的 inode_cache 中分配
+    inode_found = (struct inode*)kmem_cache_alloc(inode_cache);
 
     char* inode_buf;
     if (inode_pos.two_sec) {    // 考虑跨扇区的情况
@@ -114,7 +109,7 @@ struct inode* inode_open(struct partition* part, uint32_t inode_no) {
         // i 节点表是被 partition_format 函数连续写入扇区的，所以下面可以连续读出来
         ide_read(part->my_disk, inode_pos.sec_lba, inode_buf, 2);
     } else {    // 否则，所查找的 inode 未跨扇区，一个扇区大小的缓冲区足够
-        inode_buf = (char*)sys_malloc(512);
+        inode_buf = (char*)kmem_cache_alloc(io_buf_cache);
         ide_read(part->my_disk, inode_pos.sec_lba, inode_buf, 1);
     }
     memcpy(inode_found, inode_buf + inode_pos.off_size, sizeof(struct inode));
@@ -123,7 +118,11 @@ struct inode* inode_open(struct partition* part, uint32_t inode_no) {
     list_push(&part->open_inodes, &inode_found->inode_tag);
     inode_found->i_open_cnts = 1;
 
-    sys_free(inode_buf);
+    if (inode_pos.two_sec) {
+        sys_free(inode_buf);
+    } else {
+        kmem_cache_free(io_buf_cache, inode_buf);
+    }
     return inode_found;
 }
 
@@ -133,12 +132,7 @@ void inode_close(struct inode* inode) {
     enum intr_status old_status = intr_disable();
     if (--inode->i_open_cnts == 0) {
         list_remove(&inode->inode_tag); // 将 i 节点从 part->open_inodes 中去掉
-        // inode_open 时为实现 inode 被所有进程共享，已经在 sys_malloc 为 inode 分配了内核空间，释放 inode 时也要确保释放的内核内存池
-        struct task_struct* cur = running_thread();
-        uint32_t* cur_pagedir_bak = cur->pgdir;
-        cur->pgdir = NULL;
-        sys_free(inode);
-        cur->pgdir = cur_pagedir_bak; 
+        kmem_cache_free(inode_cache, inode);
     }
     intr_set_status(old_status);
 }
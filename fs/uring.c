@@ -0,0 +1,316 @@
+#include "uring.h"
+#include "stdint.h"
+#include "global.h"
+#include "fs.h"
+#include "list.h"
+#include "sync.h"
+#include "thread.h"
+#include "memory.h"
+#include "slab.h"
+#include "string.h"
+#include "interrupt.h"
+#include "ioqueue.h"
+#include "keyboard.h"
+#include "file.h"
+
+// 提交的操作有两种执行方式:
+// 默认在 uring_enter 中由进程自己依次执行, 一次陷入完成一批操作
+// 登记时带 URING_WORKER 则交给该环专属的内核工作线程执行, 进程可在工作线程等硬盘时继续计算
+// 工作线程不使用进程的地址空间: 写入的数据和路径在提交时复制到内核页,
+// 读出的数据和 stat 结果在进程下次调用 uring_enter 时复制回用户缓冲区, 同时填入完成队列
+// 工作线程用的是进程的文件描述符表, 只读不改, 所以不接受 open 和 close;
+// 进程关闭文件要先拿到 fd_lock, 免得工作线程等硬盘时文件被关掉
+
+#define PG_SIZE 4096
+
+// 交给工作线程的一个操作
+struct uring_req {
+    struct uring_sqe sqe;   // 提交项的副本
+    int32_t res;            // 执行结果
+    void* buf;              // 内核中存放数据或路径的页, 没有为 NULL
+    uint32_t buf_pages;     // buf 的页数
+    struct list_elem tag;   // 用于 pending 或 done 队列
+};
+
+// 进程登记的环在内核中的状态
+struct uring_ctx {
+    struct uring* ring;             // 进程地址空间中的环, 只在进程自己的上下文中访问
+    struct task_struct* owner;      // 登记环的进程
+    struct task_struct* worker;     // 工作线程, 由进程自己执行时为 NULL
+    struct list pending;            // 等待工作线程执行的操作
+    struct list done;               // 已执行完, 等待复制回进程的操作
+    uint32_t inflight;              // 已交给工作线程而尚未填入完成队列的操作数
+    struct task_struct* idle;       // 没有操作可做而阻塞的工作线程, 不在等待时为 NULL
+    bool closing;                   // 进程注销环时置位, 工作线程看到后退出
+    struct semaphore exited;        // 工作线程退出前释放
+    struct task_struct* waiter;     // 在 uring_enter 中等待工作线程完成操作的进程
+    struct lock fd_lock;            // 工作线程执行操作时持有, 进程关闭文件时也要获取
+};
+
+static struct kmem_cache* ctx_cache;
+static struct kmem_cache* req_cache;
+
+// 执行一个操作, buf 为读写的数据或路径, st 存放 stat 的结果, 返回值与对应的系统调用相同
+static int32_t uring_exec(const struct uring_sqe* sqe, void* buf, struct stat* st) {
+    switch (sqe->opcode) {
+        case URING_NOP:
+            return 0;
+        case URING_READ:
+            return sys_read(sqe->fd, buf, sqe->len);
+        case URING_WRITE:
+            return sys_write(sqe->fd, buf, sqe->len);
+        case URING_LSEEK:
+            return sys_lseek(sqe->fd, sqe->off, sqe->flags);
+        case URING_OPEN:
+            return sys_open(buf, sqe->flags);
+        case URING_CLOSE:
+            return sys_close(sqe->fd);
+        case URING_STAT:
+            return sys_stat(buf, st);
+    }
+    return -1;
+}
+
+// 向完成队列追加一项, 调用者已保证队列中有空位
+static void uring_post(struct uring* ring, uint32_t user_data, int32_t res) {
+    struct uring_cqe* cqe = &ring->cqes[ring->cq_tail & (URING_CQ_ENTRIES - 1)];
+    cqe->user_data = user_data;
+    cqe->res = res;
+    ring->cq_tail++;
+}
+
+static void uring_req_free(struct uring_req* req) {
+    if (req->buf != NULL) {
+        mfree_page(PF_KERNEL, req->buf, req->buf_pages);
+    }
+    kmem_cache_free(req_cache, req);
+}
+
+// 在进程的上下文中为提交项 sqe 准备交给工作线程的操作, 把写入的数据和路径复制到内核页
+// 路径过长或内存不足时返回 NULL
+static struct uring_req* uring_req_prepare(const struct uring_sqe* sqe) {
+    struct uring_req* req = kmem_cache_alloc(req_cache);
+    if (req == NULL) {
+        return NULL;
+    }
+    req->sqe = *sqe;
+    req->res = -1;
+    req->buf = NULL;
+    req->buf_pages = 0;
+    switch (sqe->opcode) {
+        case URING_READ:
+        case URING_WRITE:
+            if (req->sqe.len > URING_IO_MAX) {
+                req->sqe.len = URING_IO_MAX;
+            }
+            req->buf_pages = DIV_ROUND_UP(req->sqe.len, PG_SIZE);
+            break;
+        case URING_STAT:
+            // 路径放在页首, stat 的结果紧随其后
+            if (strlen((const char*)sqe->addr) >= MAX_PATH_LEN) {
+                kmem_cache_free(req_cache, req);
+                return NULL;
+            }
+            req->buf_pages = 1;
+            break;
+    }
+    if (req->buf_pages > 0) {
+        req->buf = get_kernel_pages(req->buf_pages);
+        if (req->buf == NULL) {
+            kmem_cache_free(req_cache, req);
+            return NULL;
+        }
+    }
+    if (sqe->opcode == URING_WRITE) {
+        memcpy(req->buf, (const void*)sqe->addr, req->sqe.len);
+    } else if (sqe->opcode == URING_STAT) {
+        strcpy(req->buf, (const char*)sqe->addr);
+    }
+    return req;
+}
+
+// 把工作线程已执行完的操作的结果复制回进程并填入完成队列, 在进程的上下文中调用
+static void uring_reap(struct uring_ctx* ctx) {
+    while (!list_empty(&ctx->done)) {
+        struct uring_req* req = elem2entry(struct uring_req, tag, list_pop(&ctx->done));
+        if (req->sqe.opcode == URING_READ && req->res > 0) {
+            memcpy((void*)req->sqe.addr, req->buf, req->res);
+        } else if (req->sqe.opcode == URING_STAT && req->res == 0) {
+            memcpy((void*)req->sqe.addr2, (uint8_t*)req->buf + MAX_PATH_LEN, sizeof(struct stat));
+        }
+        uring_post(ctx->ring, req->sqe.user_data, req->res);
+        ctx->inflight--;
+        uring_req_free(req);
+    }
+}
+
+// 唤醒空闲的工作线程, 在关中断的状态下调用
+static void uring_kick(struct uring_ctx* ctx) {
+    if (ctx->idle != NULL) {
+        thread_unblock(ctx->idle);
+        ctx->idle = NULL;
+    }
+}
+
+// 工作线程, 按提交的顺序逐个执行操作, 文件描述符用的是进程的表
+// 进程注销环后退出
+static void uring_worker(void* arg) {
+    struct uring_ctx* ctx = arg;
+    running_thread()->host = ctx->owner;
+    while (1) {
+        enum intr_status old_status = intr_disable();
+        while (list_empty(&ctx->pending) && !ctx->closing) {
+            ctx->idle = running_thread();
+            thread_block(TASK_BLOCKED);
+        }
+        if (ctx->closing) {
+            intr_set_status(old_status);
+            break;
+        }
+        struct uring_req* req = elem2entry(struct uring_req, tag, list_pop(&ctx->pending));
+
+        // 与进程经系统调用执行时一样在关中断的状态下执行, 读键盘等操作要求如此
+        // 读标准输入可能一直等键盘, 不持有 fd_lock; 标准输入不会被 close 关掉, 读管道也不会睡眠
+        struct stat* st = req->sqe.opcode == URING_STAT ? (struct stat*)((uint8_t*)req->buf + MAX_PATH_LEN) : NULL;
+        bool locked = !(req->sqe.opcode == URING_READ && req->sqe.fd == stdin_no);
+        if (locked) {
+            lock_acquire(&ctx->fd_lock);
+        }
+        req->res = uring_exec(&req->sqe, req->buf, st);
+        if (locked) {
+            lock_release(&ctx->fd_lock);
+        }
+        list_append(&ctx->done, &req->tag);
+        if (ctx->waiter != NULL) {
+            thread_unblock(ctx->waiter);
+            ctx->waiter = NULL;
+        }
+        intr_set_status(old_status);
+    }
+    // sema_up 之后进程随时可能释放 ctx, 不能再访问它
+    sema_up(&ctx->exited);
+    thread_exit(running_thread(), true);
+}
+
+// 为当前进程登记提交/完成环 ring, flags 含 URING_WORKER 时创建工作线程, ring 为 NULL 时注销已登记的环
+// 成功返回 0, 已登记过或内存不足时返回 -1
+int32_t sys_uring_setup(struct uring* ring, uint32_t flags) {
+    struct task_struct* cur = running_thread();
+    if (ring == NULL) {
+        uring_release(cur);
+        return 0;
+    }
+    if (cur->pgdir == NULL || cur->uring != NULL || (uint32_t)ring >= 0xc0000000 - sizeof(struct uring)) {
+        return -1;
+    }
+    struct uring_ctx* ctx = kmem_cache_alloc(ctx_cache);
+    if (ctx == NULL) {
+        return -1;
+    }
+    ring->sq_head = ring->sq_tail = 0;
+    ring->cq_head = ring->cq_tail = 0;
+    ctx->ring = ring;
+    ctx->owner = cur;
+    ctx->worker = NULL;
+    list_init(&ctx->pending);
+    list_init(&ctx->done);
+    ctx->inflight = 0;
+    ctx->idle = NULL;
+    ctx->closing = false;
+    sema_init(&ctx->exited, 0);
+    ctx->waiter = NULL;
+    lock_init(&ctx->fd_lock);
+    cur->uring = ctx;
+    if (flags & URING_WORKER) {
+        ctx->worker = thread_start("uring", cur->priority, uring_worker, ctx);
+    }
+    return 0;
+}
+
+// 从提交队列取出至多 to_submit 项执行或交给工作线程, 再等到完成队列中至少有 min_complete 项
+// 完成队列要为每个已提交的操作留出位置, 放不下时少提交一些; 返回提交的项数, 未登记环时返回 -1
+int32_t sys_uring_enter(uint32_t to_submit, uint32_t min_complete) {
+    struct uring_ctx* ctx = running_thread()->uring;
+    if (ctx == NULL) {
+        return -1;
+    }
+    struct uring* ring = ctx->ring;
+    uring_reap(ctx);
+
+    int32_t submitted = 0;
+    while ((uint32_t)submitted < to_submit && ring->sq_head != ring->sq_tail && \
+           ctx->inflight + (ring->cq_tail - ring->cq_head) < URING_CQ_ENTRIES) {
+        struct uring_sqe sqe = ring->sqes[ring->sq_head & (URING_ENTRIES - 1)];
+        ring->sq_head++;
+        submitted++;
+        if (ctx->worker == NULL) {
+            uring_post(ring, sqe.user_data, uring_exec(&sqe, (void*)sqe.addr, (struct stat*)sqe.addr2));
+            continue;
+        }
+        // 工作线程不改动进程的文件描述符表, open 和 close 直接以失败完成
+        struct uring_req* req = NULL;
+        if (sqe.opcode != URING_OPEN && sqe.opcode != URING_CLOSE) {
+            req = uring_req_prepare(&sqe);
+        }
+        if (req == NULL) {
+            uring_post(ring, sqe.user_data, -1);
+            continue;
+        }
+        ctx->inflight++;
+        enum intr_status old_status = intr_disable();
+        list_append(&ctx->pending, &req->tag);
+        uring_kick(ctx);
+        intr_set_status(old_status);
+    }
+
+    // 工作线程每完成一个操作就唤醒等待的进程, 由进程自己把结果复制回来
+    while (ring->cq_tail - ring->cq_head < min_complete && ctx->inflight > 0) {
+        enum intr_status old_status = intr_disable();
+        if (list_empty(&ctx->done)) {
+            ctx->waiter = running_thread();
+            thread_block(TASK_BLOCKED);
+        }
+        intr_set_status(old_status);
+        uring_reap(ctx);
+    }
+    return submitted;
+}
+
+// 注销进程 pthread 登记的环, 在该进程自己的上下文中调用
+// 工作线程正在执行的操作会做完, 尚未开始的直接丢弃, 已完成而未取回的结果也一并丢弃
+// 工作线程若在等键盘输入, 就取消等待, 该读操作只返回已读到的部分, 否则进程退出时会一直卡在这里
+void uring_release(struct task_struct* pthread) {
+    struct uring_ctx* ctx = pthread->uring;
+    if (ctx == NULL) {
+        return;
+    }
+    if (ctx->worker != NULL) {
+        // 工作线程做完手头的操作后看到 closing 即退出, 不再从 pending 中取
+        enum intr_status old_status = intr_disable();
+        ctx->closing = true;
+        uring_kick(ctx);
+        intr_set_status(old_status);
+        ioq_cancel(&kbd_buf, ctx->worker);
+        sema_down(&ctx->exited);
+        while (!list_empty(&ctx->pending)) {
+            uring_req_free(elem2entry(struct uring_req, tag, list_pop(&ctx->pending)));
+        }
+        while (!list_empty(&ctx->done)) {
+            uring_req_free(elem2entry(struct uring_req, tag, list_pop(&ctx->done)));
+        }
+    }
+    pthread->uring = NULL;
+    kmem_cache_free(ctx_cache, ctx);
+}
+
+// 返回进程 pthread 关闭文件前要获取的锁, 没有交给工作线程执行的环时返回 NULL
+struct lock* uring_fd_lock(struct task_struct* pthread) {
+    struct uring_ctx* ctx = pthread->uring;
+    return ctx != NULL && ctx->worker != NULL ? &ctx->fd_lock : NULL;
+}
+
+// 创建提交/完成环用到的对象缓存, 需在对象缓存初始化之后调用
+void uring_init(void) {
+    ctx_cache = kmem_cache_create("uring_ctx", sizeof(struct uring_ctx), 0, NULL);
+    req_cache = kmem_cache_create("uring_req", sizeof(struct uring_req), 0, NULL);
+}
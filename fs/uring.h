@@ -0,0 +1,60 @@
+#ifndef __FS_URING_H
+#define __FS_URING_H
+#include "stdint.h"
+#include "global.h"
+
+#define URING_ENTRIES 32                        // 提交队列的项数, 须为 2 的幂
+#define URING_CQ_ENTRIES (URING_ENTRIES * 2)    // 完成队列的项数, 须为 2 的幂
+#define URING_IO_MAX (16 * 4096)                // 工作线程方式下单个读写操作的最大字节数, 超出的部分按短读写处理
+
+#define URING_WORKER 1      // uring_setup 的标志: 提交的操作交给内核工作线程执行
+
+// 可以提交的操作
+enum uring_op {
+    URING_NOP,      // 什么也不做, 结果为 0
+    URING_READ,     // read(fd, addr, len)
+    URING_WRITE,    // write(fd, addr, len)
+    URING_LSEEK,    // lseek(fd, off, flags)
+    URING_OPEN,     // open(addr, flags), 工作线程方式下不支持, 结果为 -1
+    URING_CLOSE,    // close(fd), 工作线程方式下不支持, 结果为 -1
+    URING_STAT      // stat(addr, addr2)
+};
+
+// 提交项, 描述一个操作
+struct uring_sqe {
+    uint8_t opcode;         // enum uring_op
+    uint8_t flags;          // open 的 flags 或 lseek 的 whence
+    int32_t fd;
+    uint32_t addr;          // 读写的缓冲区或路径
+    uint32_t addr2;         // stat 的结果
+    uint32_t len;           // 读写的字节数
+    int32_t off;            // lseek 的偏移量
+    uint32_t user_data;     // 原样带回完成项, 供用户程序区分各个操作
+};
+
+// 完成项, 内容与对应系统调用的返回值相同
+struct uring_cqe {
+    uint32_t user_data;
+    int32_t res;
+};
+
+// 进程与内核共享的提交/完成环, 由进程在自己的地址空间中分配, 经 uring_setup 登记
+// 提交队列由进程推进 sq_tail, 内核推进 sq_head; 完成队列由内核推进 cq_tail, 进程推进 cq_head
+// 下标只增不减, 与队列项数取模得到位置, 相减得到队列中的项数
+struct uring {
+    volatile uint32_t sq_head;
+    volatile uint32_t sq_tail;
+    volatile uint32_t cq_head;
+    volatile uint32_t cq_tail;
+    struct uring_sqe sqes[URING_ENTRIES];
+    struct uring_cqe cqes[URING_CQ_ENTRIES];
+};
+
+struct task_struct;
+struct lock;
+void uring_init(void);
+int32_t sys_uring_setup(struct uring* ring, uint32_t flags);
+int32_t sys_uring_enter(uint32_t to_submit, uint32_t min_complete);
+void uring_release(struct task_struct* pthread);
+struct lock* uring_fd_lock(struct task_struct* pthread);
+#endif
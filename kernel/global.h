@@ -39,10 +39,16 @@
 #define SELECTOR_U_CODE	   ((5 << 3) + (TI_GDT << 2) + RPL3)
 #define SELECTOR_U_DATA	   ((6 << 3) + (TI_GDT << 2) + RPL3)
 #define SELECTOR_U_STACK   SELECTOR_U_DATA
+/* 第7至10个段描述符供 sysenter/sysexit 使用, 两条指令要求按 内核代码 内核栈 用户代码 用户栈 的顺序相邻排列 */
+#define SELECTOR_SYSENTER_CS ((7 << 3) + (TI_GDT << 2) + RPL0)
+#define SELECTOR_SYSEXIT_CS  ((9 << 3) + (TI_GDT << 2) + RPL3)
+#define SELECTOR_SYSEXIT_SS  ((10 << 3) + (TI_GDT << 2) + RPL3)
 
 #define GDT_ATTR_HIGH		     ((DESC_G_4K << 7) + (DESC_D_32  << 6) + (DESC_L << 5)      +(DESC_AVL << 4))
 #define GDT_CODE_ATTR_LOW_DPL3	 ((DESC_P << 7)    + (DESC_DPL_3 << 5) + (DESC_S_CODE << 4) + DESC_TYPE_CODE)
 #define GDT_DATA_ATTR_LOW_DPL3	 ((DESC_P << 7)    + (DESC_DPL_3 << 5) + (DESC_S_DATA << 4) + DESC_TYPE_DATA)
+#define GDT_CODE_ATTR_LOW_DPL0	 ((DESC_P << 7)    + (DESC_DPL_0 << 5) + (DESC_S_CODE << 4) + DESC_TYPE_CODE)
+#define GDT_DATA_ATTR_LOW_DPL0	 ((DESC_P << 7)    + (DESC_DPL_0 << 5) + (DESC_S_DATA << 4) + DESC_TYPE_DATA)
 
 /*-------------- TSS描述符属性 －－－－－－－－－－－－*/
 #define TSS_DESC_D  0 
@@ -10,13 +10,20 @@
 #include "syscall-init.h"
 #include "ide.h"
 #include "fs.h"
+#include "vma.h"
+#include "swap.h"
+#include "vdata.h"
+#include "uring.h"
 /* 负责初始化所有模块 */
 void init_all(){
 	put_str("init_all\n");
 	idt_init();		// 初始化 中断
 	mem_init();		// 初始化内存池
+	vma_init();		// 初始化进程地址空间的区域管理
+	uring_init();	// 初始化提交/完成环
 	thread_init();	// 初始化线程
 	timer_init();	// 初始化 PIT
+	vdata_init();	// 映射用户只读的共享数据页
 	console_init();	// 初始化终端
 	keyboard_init();// 初始化键盘
 	tss_init();		// 初始化 TSS
@@ -25,5 +32,6 @@ void init_all(){
     intr_enable();      // 后面的 ide_init 需要打开中断
     ide_init();         // 初始化硬盘
     filesys_init();     // 初始化文件系统
+    swap_init();        // 初始化交换分区, 启动换出线程
 }
 
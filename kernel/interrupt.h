@@ -15,6 +15,7 @@ enum intr_status intr_enable();
 enum intr_status intr_disable();
 enum intr_status intr_set_status(enum intr_status status);
 enum intr_status intr_get_status();
+void register_handler(uint8_t vector_no, intr_handler function);
 
 #endif
 
@@ -1,5 +1,7 @@
 #include "memory.h" 
 #include "bitmap.h"
+#include "buddy.h"
+#include "slab.h"
 #include "stdint.h"
 #include "print.h" 
 #include "global.h"
@@ -8,114 +10,342 @@
 #include "thread.h"
 #include "sync.h"
 #include "interrupt.h"
+#include "process.h"
+#include "vma.h"
+#include "wait_exit.h"
+#include "stdio-kernel.h"
+#include "stdio.h"
+#include "io.h"
+#include "swap.h"
 
 #define PG_SIZE 4096
 
+#define PF_ERR_P 0x1	//缺页错误码: 为 1 表示页存在, 是保护性错误
+#define PF_ERR_W 0x2	//缺页错误码: 为 1 表示由写操作引起
+#define PF_ERR_U 0x4	//缺页错误码: 为 1 表示在用户态引起
+
+#define CPUID_PSE 0x8		//cpuid 1 号功能 edx 中表示支持 4MB 大页的位
+#define CPUID_PGE 0x2000	//cpuid 1 号功能 edx 中表示支持全局页的位
+#define CR4_PSE 0x10		//cr4 中开启 4MB 大页的位
+#define CR4_PGE 0x80		//cr4 中开启全局页的位
+#define PG_SIZE_4M 0x400000	//页目录项直接映射的大页大小
+
 #define PDE_IDX(addr) ((addr & 0xffc00000) >> 22)
 #define PTE_IDX(addr) ((addr & 0x003ff000) >> 12)
 int page_table_add_num = 0;
-/* 位图地址 */
-//因为 0xc009f000是内核主线程栈顶， 0xc009e000是内核主线程的pcb。
-//一个页框大小的位图可表示128MB内存，位图位置安排在地址0xc009a000,这样本系统最大支持4个页框的位图， 即512MB
-#define MEM_BITMAP_BASE 0xc009a000
 
 //0xc0000000是内核从虚拟地址3G 起。0x100000意指跨过低端1MB内存，使虚拟地址在逻辑上连续
+//内核堆最前面存放伙伴系统的页节点数组，其后才是可分配的内核虚拟地址
 #define K_HEAP_START 0xc0100000
 
-//内存池结构，生成两个实例用于管理内核内存池和用户内存池
+#define ZERO_POOL_PAGES 32	//最多预先清零的页数
+#define ZERO_FILL_BATCH 8	//idle 线程每次最多清零的页数
+#define RELEASE_BATCH 64	//进程退出时每批归还的页数
+#define SWAP_CLUSTER 16		//每次最多换出的页数
+#define SWAPPER_PRIO 16		//换出线程的优先级
+
+//水位按全部页框数的比例设置: 最低水位即为内核保留的页数
+#define WMARK_MIN_DIV 16	//最低水位为总页数的 1/16
+#define WMARK_LOW_DIV 8		//低水位为总页数的 1/8
+#define WMARK_HIGH_DIV 4	//高水位为总页数的 1/4
+
+//物理页框分配器，内核与用户内存池从同一个伙伴系统中取页，两者的占用随负载此消彼长
+//空闲页(含预清零页)不多于最低水位时只分配给内核；低于低水位进入紧张状态，idle 线程停止预清零，换出线程开始换出
+//紧张状态持续到空闲页回升到高水位以上，其间由换出线程把用户页换出到交换分区
+struct frame_pool{
+	struct buddy frame_buddy;	//管理全部空闲物理页, 每个节点对应一个页框, 含区域之间的空洞
+	uint32_t phy_addr_start;	//第一个页框的物理地址
+	uint32_t total_pages;		//可用的页框数, 不含空洞
+	uint32_t zero_pages[ZERO_POOL_PAGES];	//已由 idle 线程清零的空闲物理页, 两个内存池共用
+	uint32_t zero_cnt;			//zero_pages 中的页数, 关中断访问
+	uint32_t wmark_min;			//最低水位, 即为内核保留的页数
+	uint32_t wmark_low;			//低水位
+	uint32_t wmark_high;		//高水位
+	bool pressure;				//是否处于紧张状态
+	uint32_t pressure_cnt;		//进入紧张状态的次数
+	uint32_t reserve_denied;	//为保留内核页而拒绝用户内存池的次数
+	uint32_t swapper_runs;		//换出线程被唤醒的次数
+	uint32_t direct_reclaims;	//分配用户页失败时就地换出的次数
+};
+
+//loader 通过 BIOS 中断 0x15 子功能 0xe820 取得的内存布局, 留在 loader 的数据区中, 见 boot/loader.S
+#define TOTAL_MEM_BYTES_ADDR 0xb00	//total_mem_bytes, 最高的内存地址
+#define ARDS_BUF_ADDR 0xb0a		//ards_buf, ARDS 结构数组
+#define BOOT_FLAGS_ADDR 0xbfa	//boot_flags, 启动选项, 可直接改写硬盘中的 loader, 见 makefile 的 flags 目标
+#define BOOT_NO_PSE 0x1			//boot_flags 中关闭 4MB 大页的位
+#define ARDS_NR_ADDR 0xbfe		//ards_nr, ARDS 结构的个数
+#define ARDS_MAX 12				//ards_buf 最多容纳的 ARDS 结构数
+#define ARDS_TYPE_RAM 1			//可供操作系统使用的内存
+#define MEM_LIMIT_4G 0x100000000ULL	//不开启 PAE 只能访问 4GB 以内的物理内存
+
+//地址范围描述符, 由 BIOS 填写
+struct ards{
+	uint32_t base_low;
+	uint32_t base_high;
+	uint32_t length_low;
+	uint32_t length_high;
+	uint32_t type;
+} __attribute__((packed));
+
+//内存池结构，生成两个实例分别记录内核和用户对物理页的使用，页框都来自 frames
 struct pool{
-	struct bitmap pool_bitmap;	//本内存池用到的位图结构， 用于管理物理内存
-	uint32_t phy_addr_start;	//本内存池所管理物理内存的起始地址
-	uint32_t pool_size;			//本内存池字节容量
+	enum pool_flags flag;		//PF_KERNEL 或 PF_USER
 	struct lock lock; 			//申请内存时互斥
+	uint32_t pages;				//当前占用的页数
+	uint32_t peak_pages;		//占用页数的峰值
+	uint32_t moved_in;			//取得的页中上次属于另一个内存池的页数
+	uint32_t large_cnt;			//sys_malloc 分配出去的大块内存数
+	uint32_t large_pages;		//大块内存占用的页数
+	uint32_t large_bytes;		//大块内存实际申请的字节数
+	uint32_t page_allocs;		//从页框分配器取得的页数
+	uint32_t page_frees;		//归还页框分配器的页数
+	uint64_t lock_start;		//最近一次拿到锁时的时间戳计数
+	uint64_t lock_cycles;		//累计持有锁的时钟周期数
+};
+
+//内核虚拟地址池，同样用伙伴系统管理内核堆的虚拟页
+struct kernel_vaddr_pool{
+	struct buddy vaddr_buddy;	//虚拟地址用到的伙伴系统
+	uint32_t vaddr_start;		//虚拟地址起始地址
 };
 
-// 内存仓库 arena 元信息
-struct arena {
-    struct mem_block_desc* desc;
-    // large 为 true 时, cnt 表示的是页框数
-    // 否则 cnt 表示空闲 mem_block 数量
-    uint32_t cnt;
-    bool large;
+// 内核内存池中页外 arena 的记录, 按页地址散列
+// 用户进程的页外 arena 存放在该页所属的区域 vm_area 中, 随 fork 一起复制
+struct arena_meta {
+    struct arena a;
+    struct list_elem hash_tag;
 };
+#define META_HASH_CNT 64
+static struct list meta_hash[META_HASH_CNT];
+static struct kmem_cache* meta_cache;
 
 struct mem_block_desc k_block_descs[DESC_CNT]; // 内核内存块描述符数组
 struct pool kernel_pool, user_pool;	//生成内核内存池和用户内存池
-struct virtual_addr kernel_vaddr; 	//此结构用来给内核分配虚拟地址
+static struct frame_pool frames;		//两个内存池共用的物理页框
+struct kernel_vaddr_pool kernel_vaddr; 	//此结构用来给内核分配虚拟地址
+
+//临时映射窗口，每种用途独占一个内核虚拟页，用来访问直接映射区以外的物理页
+static uint32_t kmap_window[KMAP_CNT];
+static uint32_t dmap_end;	//直接映射的物理内存上限, 低于此地址的物理页都映射在 DMAP_BASE 起的直接映射区
+
+static bool pge_supported;	//处理器是否支持全局页
+static bool pse_enabled;	//直接映射区是否用 4MB 大页映射
+
+static struct task_struct* swapper_thread;	//换出线程, 没有交换分区时不创建
+static bool swapper_idle;	//换出线程是否在等待唤醒
+
+//时钟算法的指针: 按 pid 从小到大依次扫描各进程, 进程内按地址扫描区域中的页表项
+static struct{
+	pid_t pid;		//正在扫描的进程
+	uint32_t vaddr;	//下次从此地址开始扫描
+} clock_hand;
+
+//返回 cpuid 1 号功能在 edx 中给出的处理器特性
+static uint32_t cpuid_features(void){
+	uint32_t eax = 1, ebx, ecx, edx;
+	asm volatile ("cpuid" : "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx));
+	return edx;
+}
+
+// 申请内存池 m_pool 的锁, 最外层的申请记下拿到锁的时刻
+static void pool_lock(struct pool* m_pool){
+	lock_acquire(&m_pool->lock);
+	if(m_pool->lock.holder_repeat_nr == 1){
+		m_pool->lock_start = rdtsc();
+	}
+}
 
-//初始化内存池
-static void mem_pool_init(uint32_t all_mem) { 
+// 释放内存池 m_pool 的锁, 最外层的释放累计本次持有锁的时间
+static void pool_unlock(struct pool* m_pool){
+	if(m_pool->lock.holder_repeat_nr == 1){
+		m_pool->lock_cycles += rdtsc() - m_pool->lock_start;
+	}
+	lock_release(&m_pool->lock);
+}
+
+static void page_table_add(void* _vaddr, void* _page_phyaddr);
+static uint32_t swap_out_pages(uint32_t want);
+
+//把 loader 得到的区域 [base, base + length) 换算成完整的页号区间 [*start_pg, *end_pg)
+//只能使用 4GB 以内的内存, 超出的部分丢弃, 区域不含完整的页时 *start_pg 不小于 *end_pg
+static void ards_pages(struct ards* ards, uint32_t* start_pg, uint32_t* end_pg){
+	uint64_t base = ((uint64_t)ards->base_high << 32) | ards->base_low;
+	uint64_t end = base + (((uint64_t)ards->length_high << 32) | ards->length_low);
+	if(end > MEM_LIMIT_4G){
+		end = MEM_LIMIT_4G;
+	}
+	*start_pg = base >= MEM_LIMIT_4G ? MEM_LIMIT_4G >> 12 : (uint32_t)((base + PG_SIZE - 1) >> 12);
+	*end_pg = (uint32_t)(end >> 12);
+}
+
+//取出 ards_nr 个区域中可用内存的页号区间, 按起始页号排序, 重叠或相接的区间合并成一个
+//BIOS 给出的区域可能无序, 也可能互相重叠, 不合并的话同一页会被两次释放到伙伴系统, 返回区间数
+static uint32_t ram_ranges(struct ards* ards, uint32_t ards_nr, uint32_t* starts, uint32_t* ends){
+	uint32_t cnt = 0, start_pg, end_pg, idx, pos;
+	for(idx = 0; idx < ards_nr; idx++){
+		ards_pages(&ards[idx], &start_pg, &end_pg);
+		if(ards[idx].type != ARDS_TYPE_RAM || start_pg >= end_pg){
+			continue;
+		}
+		//插入排序, 区域最多 ARDS_MAX 个
+		pos = cnt++;
+		while(pos > 0 && starts[pos - 1] > start_pg){
+			starts[pos] = starts[pos - 1];
+			ends[pos] = ends[pos - 1];
+			pos--;
+		}
+		starts[pos] = start_pg;
+		ends[pos] = end_pg;
+	}
+	if(cnt == 0){
+		return 0;
+	}
+	pos = 0;
+	for(idx = 1; idx < cnt; idx++){
+		if(starts[idx] <= ends[pos]){
+			if(ends[idx] > ends[pos]){
+				ends[pos] = ends[idx];
+			}
+		}else{
+			pos++;
+			starts[pos] = starts[idx];
+			ends[pos] = ends[idx];
+		}
+	}
+	return pos + 1;
+}
+
+//初始化内存池, ards 为 loader 取得的 ards_nr 个内存区域, 为 0 个时只用 all_mem 这一段
+static void mem_pool_init(struct ards* ards, uint32_t ards_nr, uint32_t all_mem) { 
 	put_str("mem_pool_init start\n");
 	uint32_t page_table_size = PG_SIZE * 256;	//记录页目录表和页表占用的字节大小
 	//页表大小 ＝ 1页的页目录表 ＋第 0 和第 768 个页目录项指向同一个页表,之前创建页表的时候，挨着页目录表创建了768-1022总共255个页表+上页目录的1页大小，就是256
 	//第 769~1022 个页目录项共指向 254 个页表，共 256 个页框
 		
 	uint32_t used_mem = page_table_size + 0x100000; //当前已经使用的内存字节数，1M部分已经使用了，1M往上是页表所占用的空间
-	uint32_t free_mem = all_mem - used_mem;		//剩余可用内存字节数
-	uint16_t all_free_pages = free_mem / PG_SIZE; 	//所有可用的页
-	// 1页为 4KB, 不管总内存是不是 4k 的倍数,对于以页为单位的内存分配策略， 不足 1 页的内存不用考虑了
-	
-	uint16_t kernel_free_pages = all_free_pages / 2;
-	uint16_t user_free_pages = all_free_pages - kernel_free_pages;
-
-	//为简化位图操作，余数不处理，坏处是这样做会丢内存。好处是不用做内存的越界检查，因为位图表示的内存少于实际物理内存。
-	uint32_t kbm_length = kernel_free_pages / 8;			//Kernel Bitmap的长度，位图中的一位表示一页，以字节为单位，也就是8页表示1字节的位图
-	uint32_t ubm_length = user_free_pages /8;
-
-	uint32_t kp_start = used_mem;					//kernel pool start,内核内存池起始地址
-	uint32_t up_start = kp_start + kernel_free_pages * PG_SIZE;	//内核已使用的+没使用的，就是分配给内核的全部内存，剩下给用户
-
-	kernel_pool.phy_addr_start = kp_start;
-	user_pool.phy_addr_start = up_start;
+	// 1页为 4KB, 不管区域是不是 4k 的倍数,对于以页为单位的内存分配策略， 不足 1 页的内存不用考虑了
 
-	kernel_pool.pool_size = kernel_free_pages * PG_SIZE;		//内存池里存放的是空闲的内存，所以用可用内存大小填充
-	user_pool.pool_size = user_free_pages * PG_SIZE;
+	//没有内存布局时把 all_mem 当作从 0 开始的一个区域
+	struct ards whole = {0, 0, all_mem, 0, ARDS_TYPE_RAM};
+	if(ards_nr == 0){
+		ards = &whole;
+		ards_nr = 1;
+	}
 
-	kernel_pool.pool_bitmap.btmp_bytes_len = kbm_length;
-	user_pool.pool_bitmap.btmp_bytes_len = ubm_length;
+	//页框从 used_mem 一直编号到最高的可用页, 区域之间的空洞也有节点, 但永远不会被释放到伙伴系统
+	uint32_t range_starts[ARDS_MAX], range_ends[ARDS_MAX];
+	uint32_t range_cnt = ram_ranges(ards, ards_nr, range_starts, range_ends);
+	uint32_t max_pg = 0, low_end_pg = 0, start_pg, idx;
+	ASSERT(range_cnt > 0);
+	max_pg = range_ends[range_cnt - 1];
+	for(idx = 0; idx < range_cnt; idx++){
+		if(range_starts[idx] <= (0x100000 >> 12) && range_ends[idx] > (0x100000 >> 12)){
+			low_end_pg = range_ends[idx];	//包含 1MB 处的可用区域, 页表和节点数组都在其中
+		}
+	}
+	ASSERT(low_end_pg > (used_mem >> 12));
+
+	//伙伴系统每页需要一个节点：物理页框一组，内核虚拟地址池再一组
+	//内核最多可以占用全部页框，但内核虚拟地址池不能伸进 DMAP_BASE 起的直接映射区
+	//节点数组紧跟在页表之后，按上限估算占用的页数，要求它也落在 1MB 起的可用区域内
+	uint32_t frame_cnt_max = max_pg - (used_mem >> 12);
+	uint32_t vaddr_cnt_max = (DMAP_BASE - K_HEAP_START) / PG_SIZE;
+	uint32_t node_cnt_max = frame_cnt_max + (frame_cnt_max < vaddr_cnt_max ? frame_cnt_max : vaddr_cnt_max);
+	uint32_t node_pages = DIV_ROUND_UP(node_cnt_max * sizeof(struct buddy_node), PG_SIZE);
+
+	uint32_t node_start = used_mem;					//伙伴系统节点数组的物理起始地址
+	frames.phy_addr_start = node_start + node_pages * PG_SIZE;	//第一个页框的物理地址
+	ASSERT(low_end_pg > (frames.phy_addr_start >> 12));
+	uint32_t frame_cnt = max_pg - (frames.phy_addr_start >> 12);
+
+	//节点数组映射到内核堆起始处，第 768~1022 个页目录项对应的页表都已存在，可直接添加映射
+	uint32_t pg_idx = 0;
+	while(pg_idx < node_pages){
+		page_table_add((void*)(K_HEAP_START + pg_idx * PG_SIZE), (void*)(node_start + pg_idx * PG_SIZE));
+		pg_idx++;
+	}
+	struct buddy_node* nodes = (struct buddy_node*)K_HEAP_START;
+
+	//初始时所有页框都已占用, 再按地址顺序释放可用区域中的页
+	//第一个页框以下是低端 1MB、内核映像、页表和节点数组, 区域落在这里的部分要裁掉
+	buddy_init_used(&frames.frame_buddy, nodes, frame_cnt);
+	for(idx = 0; idx < range_cnt; idx++){
+		start_pg = range_starts[idx];
+		if(start_pg < (frames.phy_addr_start >> 12)){
+			start_pg = frames.phy_addr_start >> 12;
+		}
+		if(start_pg < range_ends[idx]){
+			buddy_free_pages(&frames.frame_buddy, start_pg - (frames.phy_addr_start >> 12), range_ends[idx] - start_pg);
+		}
+	}
+	frames.total_pages = frames.frame_buddy.free_pages;
 
-	//内核内存池和用户内存池位图
-	//位图是全局的数据，长度不固定。
-	//全局或静态的数组需要在编译时知道其长度，而我们需要根据总内存 大小算出需要多少字节，所以改为指定一块内存来生成位图。
-	//内核使用的最高地址是Oxc009f000, 这是主线程的栈地址，32MB内存占用的位图是2KB
-	//内核内存池的位图先定在 MEM_BITMAP_BASE(Oxc009a000)处
-	
-	kernel_pool.pool_bitmap.bits = (void*)MEM_BITMAP_BASE;
-	user_pool.pool_bitmap.bits = (void*)(MEM_BITMAP_BASE + kbm_length);
+	uint32_t kernel_vaddr_start = K_HEAP_START + node_pages * PG_SIZE;
+	uint32_t kernel_vaddr_pages = frames.total_pages;
+	if(kernel_vaddr_pages > (DMAP_BASE - kernel_vaddr_start) / PG_SIZE){
+		kernel_vaddr_pages = (DMAP_BASE - kernel_vaddr_start) / PG_SIZE;
+	}
 
 	//输出内存池信息
-	put_str("   kernel_pool_bitmap_start:"); 
-	put_int((int)kernel_pool.pool_bitmap.bits); 
+	put_str("   buddy_nodes_start:"); 
+	put_int((int)nodes); 
 
-	put_str("   kernel_pool_phy_addr_start: "); 
-	put_int(kernel_pool.phy_addr_start); 
+	put_str("   frame_phy_addr_start: "); 
+	put_int(frames.phy_addr_start); 
 
 	put_str ("\n");
 
-	put_str ("    user_pool_bitmap_start: ");
-	put_int ((int) user_pool.pool_bitmap.bits);
-
-	put_str ("    user_pool_phy_addr_start: ");
-	put_int(user_pool.phy_addr_start);
+	put_str ("    frame_pages: ");
+	put_int(frames.total_pages);
+	put_str ("   frame_phy_addr_end: ");
+	put_int(max_pg << 12);
 
 	put_str ("\n");
 
-	// 将位图置 0
-	bitmap_init(&kernel_pool.pool_bitmap);
-	bitmap_init(&user_pool.pool_bitmap);
+	frames.zero_cnt = 0;
+	frames.wmark_min = frames.total_pages / WMARK_MIN_DIV;
+	frames.wmark_low = frames.total_pages / WMARK_LOW_DIV;
+	frames.wmark_high = frames.total_pages / WMARK_HIGH_DIV;
+	frames.pressure = false;
 
+	kernel_pool.flag = PF_KERNEL;
+	user_pool.flag = PF_USER;
 	lock_init(&kernel_pool.lock);
     lock_init(&user_pool.lock);
 
-	//下面初始化内核虚拟地址的位图，按实际物理内存大小生成数组。
-	kernel_vaddr.vaddr_bitmap.btmp_bytes_len = kbm_length; 
-	//用干维护内核堆的虚拟地址，所以要和内核内存池大小一致
-	
-	//位图的数组指向一块没用的内存，目前定位在内核内存池和用户内存池之外
-	kernel_vaddr.vaddr_bitmap.bits = (void*)(MEM_BITMAP_BASE + kbm_length + ubm_length);
+	//下面初始化内核虚拟地址的伙伴系统，用干维护内核堆的虚拟地址，起始地址跨过节点数组
+	kernel_vaddr.vaddr_start = kernel_vaddr_start;
+	buddy_init(&kernel_vaddr.vaddr_buddy, nodes + frame_cnt, kernel_vaddr_pages);
 
-	kernel_vaddr.vaddr_start = K_HEAP_START;
-	bitmap_init(&kernel_vaddr.vaddr_bitmap);
+	//留出临时映射窗口，平时不映射任何物理页
+	uint32_t slot = 0;
+	while(slot < KMAP_CNT){
+		kmap_window[slot++] = kernel_vaddr.vaddr_start + buddy_alloc(&kernel_vaddr.vaddr_buddy, 0) * PG_SIZE;
+	}
+
+	//把低端物理内存线性映射到直接映射区，所有进程共享这些页目录项，最高的可用页以上没有内存，不必映射
+	//处理器支持且 loader 的 boot_flags 没有关闭时，整 4MB 的部分用页目录项直接映射大页，
+	//其余部分用 loader 建好的页表按 4KB 映射
+	dmap_end = max_pg < (DMAP_LIMIT >> 12) ? max_pg << 12 : DMAP_LIMIT;
+	pse_enabled = (cpuid_features() & CPUID_PSE) && !(*(uint32_t*)BOOT_FLAGS_ADDR & BOOT_NO_PSE);
+	if(pse_enabled){
+		uint32_t cr4;
+		asm volatile ("movl %%cr4, %0" : "=r" (cr4));
+		asm volatile ("movl %0, %%cr4" : : "r" (cr4 | CR4_PSE) : "memory");
+	}
+	uint32_t dmap_phy_addr = 0;
+	while(dmap_phy_addr < dmap_end){
+		if(pse_enabled && dmap_end - dmap_phy_addr >= PG_SIZE_4M){
+			*pde_ptr(DMAP_BASE + dmap_phy_addr) = dmap_phy_addr | PG_PS | PG_G | PG_US_S | PG_RW_W | PG_P_1;
+			dmap_phy_addr += PG_SIZE_4M;
+		}else{
+			*pte_ptr(DMAP_BASE + dmap_phy_addr) = dmap_phy_addr | PG_G | PG_US_S | PG_RW_W | PG_P_1;
+			dmap_phy_addr += PG_SIZE;
+		}
+	}
+	put_str("    direct_map_phy_addr_end: ");
+	put_int(dmap_end);
+	put_str(pse_enabled ? "   4MB pages: on\n" : "   4MB pages: off\n");
 	
 	put_str("    mem_pool_init done \n"); 
 }
@@ -123,33 +353,26 @@ static void mem_pool_init(uint32_t all_mem) {
 //在 pf 表示的虚拟内存池中申请 pg_cnt 个虚拟页，成功则返回虚拟页的起始地址，失败则返回 NULL
 static void* vaddr_get(enum pool_flags pf, uint32_t pg_cnt){
 	int vaddr_start = 0, bit_idx_start = -1;
-	uint32_t cnt = 0;
 	if(pf == PF_KERNEL){
-		bit_idx_start = bitmap_scan(&kernel_vaddr.vaddr_bitmap, pg_cnt);	//获取虚拟页的位起始值
+		bit_idx_start = buddy_alloc_pages(&kernel_vaddr.vaddr_buddy, pg_cnt);	//从伙伴系统中取连续 pg_cnt 个虚拟页
 		if(bit_idx_start == -1){
 			return NULL;
 		}
-		while(cnt < pg_cnt){
-			bitmap_set(&kernel_vaddr.vaddr_bitmap, bit_idx_start + cnt++, 1);	//将位起始值开始连续置1，直到设置完需要的页位置
-		}
 		vaddr_start = kernel_vaddr.vaddr_start + bit_idx_start * PG_SIZE;
-    } else { // 用户内存池
+    } else { // 用户内存池, 在进程的区域树中找一段空隙并登记为区域
         struct task_struct* cur = running_thread();
-        bit_idx_start = bitmap_scan(&cur->userprog_vaddr.vaddr_bitmap, pg_cnt);
-        if(bit_idx_start == -1) {
+        vaddr_start = vma_get_unmapped(cur, pg_cnt * PG_SIZE, USER_VADDR_START, 0xc0000000);
+        if(vaddr_start == 0 || !vma_add(cur, vaddr_start, vaddr_start + pg_cnt * PG_SIZE, VMA_HEAP)) {
             return NULL;
         }
-        while(cnt < pg_cnt) {
-            bitmap_set(&cur->userprog_vaddr.vaddr_bitmap, bit_idx_start+cnt++, 1);
-        }
-        vaddr_start = cur->userprog_vaddr.vaddr_start + bit_idx_start * PG_SIZE;
-        ASSERT((uint32_t)vaddr_start < (0xc0000000 - PG_SIZE));
 	}
 	return (void*)vaddr_start;
 }
 
 //得到虚拟地址 vaddr 对应的 pte 指针
+//大页由页目录项直接映射，没有页表项，vaddr 不能位于大页中
 uint32_t* pte_ptr(uint32_t vaddr){
+	ASSERT(!(*pde_ptr(vaddr) & PG_PS));
 	// 先访问到页表自己
 	// 再用页目录项 pde（页目录内页表的索引）作为pte的索引访问到页表
 	// 再用pte的索引作为页内偏移
@@ -170,16 +393,106 @@ uint32_t* pde_ptr(uint32_t vaddr){
 	return pde;
 }
 
+//返回物理页 pg_phy_addr 在页框伙伴系统中的节点，节点中记录了页的引用计数和所属内存池
+static struct buddy_node* page_node(uint32_t pg_phy_addr){
+	return &frames.frame_buddy.nodes[(pg_phy_addr - frames.phy_addr_start) / PG_SIZE];
+}
+
+//返回可访问物理页 pg_phy_addr 的内核虚拟地址，不受当前页目录的影响
+//直接映射区内的页直接换算地址，其它页映射到临时窗口 slot 上，窗口在 kunmap 之前不能另作他用
+void* kmap(enum kmap_slot slot, uint32_t pg_phy_addr){
+	if(pg_phy_addr < dmap_end){
+		return (void*)(DMAP_BASE + pg_phy_addr);
+	}
+	uint32_t vaddr = kmap_window[slot];
+	*pte_ptr(vaddr) = pg_phy_addr | PG_G | PG_US_S | PG_RW_W | PG_P_1;
+	asm volatile ("invlpg %0" : : "m" (*(char*)vaddr) : "memory");
+	return (void*)vaddr;
+}
+
+//撤销 kmap 返回的地址 vaddr 上的映射，直接映射区的地址什么也不做
+void kunmap(void* vaddr){
+	if((uint32_t)vaddr >= DMAP_BASE){
+		return;
+	}
+	*pte_ptr((uint32_t)vaddr) = 0;
+	asm volatile ("invlpg %0" : : "m" (*(char*)vaddr) : "memory");
+}
+
+//空闲页框数, 预清零的页也是空闲的, 需关中断调用
+static uint32_t frames_free(void){
+	return frames.frame_buddy.free_pages + frames.zero_cnt;
+}
+
+//唤醒等待中的换出线程, 需关中断调用
+static void swapper_wake(void){
+	if(swapper_idle){
+		swapper_idle = false;
+		thread_unblock(swapper_thread);
+	}
+}
+
+//按 af 的要求为 m_pool 分配 1 个物理页, *zeroed 返回该页是否已经清零, 失败返回 NULL
+//需要清零时优先取预清零的页, 不需要时优先从伙伴系统分配, 把清零的页留给需要的人
+//空闲页不多于最低水位时, 剩下的页只分配给内核
+static void* palloc_af(struct pool* m_pool, enum alloc_flags af, bool* zeroed){
+	enum intr_status old_status = intr_disable();
+	uint32_t free_pages = frames_free();
+	if(m_pool->flag == PF_USER && free_pages <= frames.wmark_min){
+		frames.reserve_denied++;
+		swapper_wake();
+		intr_set_status(old_status);
+		return NULL;
+	}
+	int32_t page_idx = -1;
+	*zeroed = false;
+	if(af == AF_NOZERO || frames.zero_cnt == 0){
+		page_idx = buddy_alloc(&frames.frame_buddy, 0);
+	}
+	if(page_idx == -1 && frames.zero_cnt > 0){
+		page_idx = (frames.zero_pages[--frames.zero_cnt] - frames.phy_addr_start) / PG_SIZE;
+		*zeroed = true;
+	}
+	if(page_idx == -1){
+		intr_set_status(old_status);
+		return NULL;
+	}
+
+	//新分配的页只有一个使用者, 记到 m_pool 名下
+	struct buddy_node* node = &frames.frame_buddy.nodes[page_idx];
+	node->ref = 1;
+	if(node->owner != 0 && node->owner != m_pool->flag){
+		m_pool->moved_in++;
+	}
+	node->owner = m_pool->flag;
+	m_pool->page_allocs++;
+	if(++m_pool->pages > m_pool->peak_pages){
+		m_pool->peak_pages = m_pool->pages;
+	}
+	if(!frames.pressure && free_pages - 1 < frames.wmark_low){
+		frames.pressure = true;
+		frames.pressure_cnt++;
+		swapper_wake();
+	}
+	intr_set_status(old_status);
+	return (void*)(frames.phy_addr_start + page_idx * PG_SIZE);	//页框起始地址 + 页偏移 = 页地址
+}
+
 //在m_pool指向的物理内存池中分配1个物理页，成功则返回页框的物理地址，失败则返回NULL
 static void* palloc(struct pool* m_pool){
-	//扫描或设置位图要保证原子操作
-	int bit_idx = bitmap_scan(&m_pool->pool_bitmap, 1);	//找一个物理页面,位图中1位表示实际1页地址
-	if(bit_idx == -1){
-		return NULL;
+	bool zeroed;
+	return palloc_af(m_pool, AF_NOZERO, &zeroed);
+}
+
+//为用户内存池分配 1 个物理页，空闲页不足时就地换出一批用户页再试，因此可能阻塞在硬盘上
+//调用者须持有 user_pool 的锁，换出或交换分区用尽后仍不够时返回 NULL
+static void* user_palloc(enum alloc_flags af, bool* zeroed){
+	void* page_phyaddr = palloc_af(&user_pool, af, zeroed);
+	while(page_phyaddr == NULL && swap_out_pages(SWAP_CLUSTER) > 0){
+		frames.direct_reclaims++;
+		page_phyaddr = palloc_af(&user_pool, af, zeroed);
 	}
-	bitmap_set(&m_pool->pool_bitmap, bit_idx, 1);		//将此位的bit_idx置1
-	uint32_t page_phyaddr = ((bit_idx * PG_SIZE) + m_pool->phy_addr_start);	//物理内存池起始地址 + 页偏移 = 页地址
-	return (void*)page_phyaddr;
+	return page_phyaddr;
 }
 
 //页表中添加虚拟地址_vaddr与物理地址_page_phyaddr的映射
@@ -188,6 +501,11 @@ static void page_table_add(void* _vaddr, void* _page_phyaddr){
 	uint32_t page_phyaddr = (uint32_t)_page_phyaddr;
 	uint32_t* pde = pde_ptr(vaddr);
 	uint32_t* pte = pte_ptr(vaddr);
+	//内核空间的映射所有进程都相同, 标记为全局页, 切换页目录时不会被刷出 tlb
+	uint32_t attr = PG_US_U | PG_RW_W | PG_P_1;
+	if(vaddr >= 0xc0000000){
+		attr |= PG_G;
+	}
 	//console_put_str("page_table_add");console_put_int(++page_table_add_num);console_put_str("\n");
 
 	//执行*pte，会访问到空的 pde。所以确保pde创建完成后才能执行*pte,否则 会引发page_fault。 
@@ -198,11 +516,14 @@ static void page_table_add(void* _vaddr, void* _page_phyaddr){
 	if(*pde & 0x00000001){
 		//页目录项和页表项的第0位为P, 此处判断目录项是否存在
 		ASSERT(!(*pte & 0x00000001));	//此时pte应该不存在
+		if(*pte & PG_SWAP){	//原先换出到交换分区的内容被新页取代，交换槽不再需要
+			swap_slot_put(*pte >> 12);
+		}
 		if(!(*pte & 0x00000001)){	//只要是创建页表，pte就应该不存在，多判断一下放心
-			*pte = (page_phyaddr | PG_US_U | PG_RW_W | PG_P_1); //创建pte
+			*pte = (page_phyaddr | attr); //创建pte
 		}else{				//目前执行不到这里
 			PANIC("pte repeat");
-			*pte = (page_phyaddr | PG_US_U | PG_RW_W | PG_P_1);
+			*pte = (page_phyaddr | attr);
 		}
 	}else{
 		//页表中用到的页框一律从内核空间分配 
@@ -215,15 +536,61 @@ static void page_table_add(void* _vaddr, void* _page_phyaddr){
 		memset((void*)((int)pte & 0xfffff000), 0, PG_SIZE);
 
 		ASSERT(!(*pte & 0x00000001));
-		*pte = (page_phyaddr | PG_US_U | PG_RW_W | PG_P_1);
+		*pte = (page_phyaddr | attr);
 	}
 }
 
 
-// 分配 pg_cnt 个页空间， 成功则返回起始虚拟地址，失败时返回 NULL
-void* malloc_page(enum pool_flags pf, uint32_t pg_cnt){
+// 判断虚拟地址 vaddr 所在的页是否已映射, pde 不存在时不能去访问 pte
+bool page_mapped(uint32_t vaddr) {
+	uint32_t pde = *pde_ptr(vaddr);
+	return (pde & PG_P_1) && ((pde & PG_PS) || (*pte_ptr(vaddr) & PG_P_1));
+}
+
+// 为用户地址 vaddr 所在页分配一个清零的物理页并建立映射, 不改动虚拟地址位图
+// 若拿到的不是预清零的页, 在释放锁之后再清零
+static void* map_zeroed_user_page(uint32_t vaddr) {
+	bool zeroed;
+	vaddr &= 0xfffff000;
+	pool_lock(&user_pool);
+	void* page_phyaddr = user_palloc(AF_ZERO, &zeroed);
+	if(page_phyaddr == NULL){
+		pool_unlock(&user_pool);
+		return NULL;
+	}
+	page_table_add((void*)vaddr, page_phyaddr);
+	pool_unlock(&user_pool);
+	if(!zeroed){
+		memset((void*)vaddr, 0, PG_SIZE);
+	}
+	return (void*)vaddr;
+}
+
+// 分配 pg_cnt 个页空间，af 为 AF_ZERO 时保证内容清零， 成功则返回起始虚拟地址，失败时返回 NULL
+static void* malloc_page_af(enum pool_flags pf, uint32_t pg_cnt, enum alloc_flags af){
 	ASSERT(pg_cnt > 0 && pg_cnt < 3840);
 	
+	//内核的单页优先用直接映射区中的地址，不占内核虚拟地址也不用改页表，开启大页时还能节省 tlb
+	if(pf == PF_KERNEL && pg_cnt == 1){
+		bool zeroed;
+		uint32_t page_phyaddr = (uint32_t)palloc_af(&kernel_pool, af, &zeroed);
+		if(page_phyaddr == 0){
+			return NULL;
+		}
+		void* page = page_phyaddr < dmap_end ? (void*)(DMAP_BASE + page_phyaddr) : vaddr_get(PF_KERNEL, 1);
+		if(page == NULL){
+			pfree(page_phyaddr);
+			return NULL;
+		}
+		if((uint32_t)page < DMAP_BASE){
+			page_table_add(page, (void*)page_phyaddr);
+		}
+		if(af == AF_ZERO && !zeroed){
+			memset(page, 0, PG_SIZE);
+		}
+		return page;
+	}
+
 	//malloc_page 的原理是三个动作的合成：
 	//1 通过 vaddr_get在虚拟内存池中申请虚拟地址
 	//2 通过 palloc在物理内存池中申请物理页
@@ -241,71 +608,95 @@ void* malloc_page(enum pool_flags pf, uint32_t pg_cnt){
 	
 	//因为虚拟地址是连续的，但物理地址不连续，所以逐个映射
 	while(cnt-- > 0){
-		void* page_phyaddr = palloc(mem_pool);
+		bool zeroed;
+		void* page_phyaddr = pf == PF_USER ? user_palloc(af, &zeroed) : palloc_af(mem_pool, af, &zeroed);
 		if(page_phyaddr == NULL){
 			//失败时要将曾经已申请的虚拟地址和
 			//物理页全部回滚，在将来完成内存回收时再补充
 			return NULL;
 		}
 		page_table_add((void*)vaddr, page_phyaddr);	//在表中逐个做映射
+		if(af == AF_ZERO && !zeroed){	//没拿到预清零的页才需要自己清零
+			memset((void*)vaddr, 0, PG_SIZE);
+		}
 		vaddr += PG_SIZE;
 	}
 	return vaddr_start;
 }
 
-// 从内核物理内存池中申请内存，成功返回虚拟地址，失败返回NULL
-void* get_kernel_pages(uint32_t pg_cnt){
-	lock_acquire(&kernel_pool.lock);
-	void* vaddr = malloc_page(PF_KERNEL, pg_cnt);
-	if(vaddr != NULL){
-		memset(vaddr, 0, pg_cnt * PG_SIZE);
-	}
-    lock_release(&kernel_pool.lock);
+// 分配 pg_cnt 个页空间，不保证内容清零， 成功则返回起始虚拟地址，失败时返回 NULL
+void* malloc_page(enum pool_flags pf, uint32_t pg_cnt){
+	return malloc_page_af(pf, pg_cnt, AF_NOZERO);
+}
+
+// 从内核物理内存池中申请内存，af 为 AF_NOZERO 时不清零，成功返回虚拟地址，失败返回NULL
+void* get_kernel_pages_af(uint32_t pg_cnt, enum alloc_flags af){
+	pool_lock(&kernel_pool);
+	void* vaddr = malloc_page_af(PF_KERNEL, pg_cnt, af);
+    pool_unlock(&kernel_pool);
 	return vaddr;
 }
 
+// 从内核物理内存池中申请清零的内存，成功返回虚拟地址，失败返回NULL
+void* get_kernel_pages(uint32_t pg_cnt){
+	return get_kernel_pages_af(pg_cnt, AF_ZERO);
+}
+
 // 在用户空间中申请 4k 内存, 并返回其虚拟地址
 void* get_user_pages(uint32_t pg_cnt) {
-    lock_acquire(&user_pool.lock);
-    void* vaddr = malloc_page(PF_USER, pg_cnt);
-    memset(vaddr, 0, pg_cnt * PG_SIZE);
-    lock_release(&user_pool.lock);
+    pool_lock(&user_pool);
+    void* vaddr = malloc_page_af(PF_USER, pg_cnt, AF_ZERO);
+    pool_unlock(&user_pool);
     return vaddr;
 }
 
 // 将地址 vaddr 与 pf 池中的物理地址关联, 仅支持一页空间分配
 void* get_a_page(enum pool_flags pf, uint32_t vaddr) {
     struct pool* mem_pool = pf & PF_KERNEL ? &kernel_pool : &user_pool;
-    lock_acquire(&mem_pool->lock);
-    // 先将虚拟地址对应的位图置 1
+    pool_lock(mem_pool);
+    // 先在虚拟地址池中占用该页
     struct task_struct* cur = running_thread();
     int32_t bit_idx = -1;
     
     if(cur->pgdir != NULL && pf == PF_USER) {
-        // 若当前是用户进程申请用户内存, 就修改用户进程自己的虚拟地址位图
-        bit_idx = (vaddr - cur->userprog_vaddr.vaddr_start) / PG_SIZE;
-        ASSERT(bit_idx > 0);
-        bitmap_set(&cur->userprog_vaddr.vaddr_bitmap, bit_idx, 1);
+        // 若当前是用户进程申请用户内存, 就把该页登记到进程的区域树中
+        ASSERT(vaddr >= USER_VADDR_START && vaddr < 0xc0000000);
+        if (!vma_reserve_page(cur, vaddr)) {
+            pool_unlock(mem_pool);
+            return NULL;
+        }
     } else if(cur->pgdir == NULL && pf == PF_KERNEL) {
-        // 如果是内核线程申请内核内存, 就修改 kernel_vaddr
+        // 如果是内核线程申请内核内存, 就从 kernel_vaddr 的伙伴系统中摘出该页
         bit_idx = (vaddr - kernel_vaddr.vaddr_start) / PG_SIZE;
         ASSERT(bit_idx > 0);
-        bitmap_set(&kernel_vaddr.vaddr_bitmap, bit_idx, 1);
+        if (!buddy_claim(&kernel_vaddr.vaddr_buddy, bit_idx)) {
+            PANIC("get_a_page: kernel vaddr already in use");
+        }
     } else {
         PANIC("get_a_page: not allow kernel alloc userspace or user alloc kernelspace by get_a_page");
     }
 
-    void* page_phyaddr = palloc(mem_pool);
+    bool zeroed;
+    void* page_phyaddr = pf == PF_USER ? user_palloc(AF_NOZERO, &zeroed) : palloc(mem_pool);
     if(page_phyaddr == NULL) {
+        pool_unlock(mem_pool);
         return NULL;
     }
     page_table_add((void*)vaddr, page_phyaddr);
-    lock_release(&mem_pool->lock);
+    pool_unlock(mem_pool);
     return (void*)vaddr;
 }
 
 // 得到虚拟地址映射到的物理地址
 uint32_t addr_v2p(uint32_t vaddr) {
+    // 直接映射区是线性的, 不必查页表
+    if (vaddr >= DMAP_BASE && vaddr - DMAP_BASE < dmap_end) {
+        return vaddr - DMAP_BASE;
+    }
+    uint32_t pde = *pde_ptr(vaddr);
+    if (pde & PG_PS) {
+        return (pde & 0xffc00000) + (vaddr & 0x003fffff);
+    }
     uint32_t* pte = pte_ptr(vaddr);
     return ((*pte & 0xfffff000) + (vaddr & 0x00000fff));
 }
@@ -313,62 +704,257 @@ uint32_t addr_v2p(uint32_t vaddr) {
 
 // 返回 arena 中第 idx 个内存块的地址
 static struct mem_block* arena2block(struct arena* a, uint32_t idx) {
-    return (struct mem_block*)((uint32_t)a + sizeof(struct arena) + idx * a->desc->block_size);
+    return (struct mem_block*)(a->base + idx * a->desc->block_size);
 }
 
-// 返回内存块 b 所在的 arena 地址
-static struct arena* block2arena(struct mem_block* b) {
-    return (struct arena*)((uint32_t)b & 0xfffff000);
+// 页地址 page 在页外 arena 散列表中的桶
+static struct list* meta_bucket(uint32_t page) {
+    return &meta_hash[(page >> 12) % META_HASH_CNT];
+}
+
+// 为起始于 page 的整页内存建立页外 arena, 调用者须持有 pf 对应内存池的锁
+static struct arena* arena_meta_alloc(enum pool_flags pf, uint32_t page) {
+    struct arena* a;
+    if (pf == PF_KERNEL) {
+        struct arena_meta* meta = kmem_cache_alloc(meta_cache);
+        if (meta == NULL) {
+            return NULL;
+        }
+        list_push(meta_bucket(page), &meta->hash_tag);
+        a = &meta->a;
+    } else {
+        // 用户进程的页由 vaddr_get 登记为区域, 区域的起始地址就是 page
+        struct vm_area* vma = vma_find(running_thread(), page);
+        ASSERT(vma != NULL && vma->start == page);
+        a = &vma->arena;
+    }
+    a->base = page;
+    return a;
+}
+
+// 释放页外 arena a, 用户进程的 arena 随所在区域一起注销, 不用单独释放
+static void arena_meta_free(enum pool_flags pf, struct arena* a) {
+    if (pf == PF_KERNEL) {
+        struct arena_meta* meta = elem2entry(struct arena_meta, a, a);
+        list_remove(&meta->hash_tag);
+        kmem_cache_free(meta_cache, meta);
+    }
+}
+
+// 返回页地址 page 的页外 arena, 没有则返回 NULL
+// 内核的散列表在关中断下查找, 与增删链表互斥, 调用者不必持有内存池的锁
+static struct arena* arena_meta_find(enum pool_flags pf, uint32_t page) {
+    if (pf == PF_KERNEL) {
+        struct arena* a = NULL;
+        struct list* bucket = meta_bucket(page);
+        enum intr_status old_status = intr_disable();
+        struct list_elem* elem = bucket->head.next;
+        while (elem != &bucket->tail) {
+            struct arena_meta* meta = elem2entry(struct arena_meta, hash_tag, elem);
+            if (meta->a.base == page) {
+                a = &meta->a;
+                break;
+            }
+            elem = elem->next;
+        }
+        intr_set_status(old_status);
+        return a;
+    }
+    struct vm_area* vma = vma_find(running_thread(), page);
+    ASSERT(vma != NULL);
+    return vma->arena.base == page ? &vma->arena : NULL;
+}
+
+// 返回内存块 b 所在的 arena, 先查页外 arena, 没有就在 b 所在页的页首
+static struct arena* block2arena(enum pool_flags pf, struct mem_block* b) {
+    uint32_t page = (uint32_t)b & 0xfffff000;
+    struct arena* a = arena_meta_find(pf, page);
+    return a != NULL ? a : (struct arena*)page;
+}
+
+// 使 fork 继承来的 free_list 的首尾节点指向本任务的链表头尾
+// 节点位于用户页, 只能在子进程自己的地址空间中改写, 所以推迟到子进程第一次用到 free_list 时
+static void desc_relink(struct mem_block_desc* desc) {
+    if (!desc->inherited) {
+        return;
+    }
+    struct list* plist = &desc->free_list;
+    if ((uint32_t)plist->head.next >= 0xc0000000) { // 父进程的链表为空, 头尾指向父进程 pcb
+        list_init(plist);
+    } else {
+        plist->head.next->prev = &plist->head;
+        plist->tail.prev->next = &plist->tail;
+    }
+    desc->inherited = false;
+}
+
+// 从 descs[desc_idx] 中一次取出 MAG_BATCH 个内存块补充到弹匣 mag, 返回补充的块数
+// free_list 为空时创建新的 arena 提供 mem_block
+static uint32_t magazine_refill(enum pool_flags PF, struct pool* mem_pool, \
+                                struct mem_block_desc* descs, uint8_t desc_idx, struct mem_magazine* mag) {
+    struct mem_block_desc* desc = &descs[desc_idx];
+    struct arena* a;
+    struct mem_block* b;
+    pool_lock(mem_pool);
+    desc_relink(desc);
+    while (mag->cnt < MAG_BATCH) {
+        if (list_empty(&desc->free_list)) {
+            // 弹匣里已有内存块就不再新建 arena, 免得大规格一次占用过多页
+            if (mag->cnt > 0) {
+                break;
+            }
+            // 内存块在分配时才清零, arena 本身无须清零
+            void* page = malloc_page(PF, 1);
+            if (page == NULL) {
+                break;
+            }
+            if (desc->block_size > ARENA_INPAGE_MAX) {
+                a = arena_meta_alloc(PF, (uint32_t)page);
+                if (a == NULL) {
+                    mfree_page(PF, page, 1);
+                    break;
+                }
+            } else {
+                a = page;
+                a->base = (uint32_t)(a + 1);
+            }
+
+            desc->arena_cnt++;
+
+            // 对于分配的小块内存, 将 desc 置为相应内存块描述符, desc_idx 置为规格的下标
+            // cnt 置为 arena 可用的内存块数, large 置为 false
+            a->desc = desc;
+            a->desc_idx = desc_idx;
+            a->large = false;
+            a->cnt = desc->blocks_per_arena;
+            uint32_t block_idx;
+
+            enum intr_status old_status = intr_disable();
+
+            // 开始将 arena 拆分成内存块, 并添加到内存块描述符的 free_list 中
+            for (block_idx = 0; block_idx < desc->blocks_per_arena; block_idx++) {
+                b = arena2block(a, block_idx);
+                ASSERT(!elem_find(&desc->free_list, &b->free_elem));
+                list_append(&desc->free_list, &b->free_elem);
+            }
+            intr_set_status(old_status);
+        }
+
+        b = elem2entry(struct mem_block, free_elem, list_pop(&desc->free_list));
+        a = block2arena(PF, b); // 获取内存块 b 所在的 arena
+        a->cnt--; // 将此 arena 中的空闲块数减 1
+        mag->blocks[mag->cnt++] = b;
+    }
+    pool_unlock(mem_pool);
+    return mag->cnt;
+}
+
+// 把弹匣 mag 底部最早放入的 cnt 个内存块归还到 desc 的 free_list
+// arena 中的内存块全部空闲时释放该 arena
+static void magazine_flush(enum pool_flags PF, struct pool* mem_pool, \
+                           struct mem_block_desc* desc, struct mem_magazine* mag, uint32_t cnt) {
+    uint32_t idx = 0;
+    ASSERT(cnt <= mag->cnt);
+    pool_lock(mem_pool);
+    desc_relink(desc);
+    while (idx < cnt) {
+        struct mem_block* b = mag->blocks[idx++];
+        struct arena* a = block2arena(PF, b);
+        list_append(&desc->free_list, &b->free_elem);
+        if (++a->cnt == desc->blocks_per_arena) {
+            uint32_t block_idx;
+            for (block_idx = 0; block_idx < desc->blocks_per_arena; block_idx++) {
+                struct mem_block* blk = arena2block(a, block_idx);
+                ASSERT(elem_find(&desc->free_list, &blk->free_elem));
+                list_remove(&blk->free_elem);
+            }
+            void* page = (void*)((uint32_t)b & 0xfffff000);
+            desc->arena_cnt--;
+            if (desc->block_size > ARENA_INPAGE_MAX) {
+                arena_meta_free(PF, a);
+            }
+            mfree_page(PF, page, 1);
+        }
+    }
+    pool_unlock(mem_pool);
+
+    // 剩余的内存块移到弹匣底部
+    for (idx = cnt; idx < mag->cnt; idx++) {
+        mag->blocks[idx - cnt] = mag->blocks[idx];
+    }
+    mag->cnt -= cnt;
+}
+
+// 把内核线程各弹匣中的内存块全部归还内核内存池, 线程退出时调用
+// 用户进程的弹匣位于其用户堆中, 随地址空间一起回收, 无须归还
+void magazine_drain(struct mem_magazine* mags) {
+    uint8_t desc_idx;
+    for (desc_idx = 0; desc_idx < DESC_CNT; desc_idx++) {
+        if (mags[desc_idx].cnt > 0) {
+            magazine_flush(PF_KERNEL, &kernel_pool, &k_block_descs[desc_idx], \
+                           &mags[desc_idx], mags[desc_idx].cnt);
+        }
+    }
 }
 
 // 在堆中申请 size 字节内存
 void* sys_malloc(uint32_t size) {	// size 申请的内存字节数
     enum pool_flags PF;
     struct pool* mem_pool;
-    uint32_t pool_size;
     struct mem_block_desc* descs;
     struct task_struct* cur_thread = running_thread();
 
     // 判断用哪个内存池
     if (cur_thread->pgdir == NULL) { // 若为内核线程
         PF = PF_KERNEL;
-        pool_size = kernel_pool.pool_size;
         mem_pool = &kernel_pool;
         descs = k_block_descs;
     } else { // 用户进程 pcb 中的 pgdir 会在为其分配页表时创建
         PF = PF_USER;
-        pool_size = user_pool.pool_size;
         mem_pool = &user_pool;
         descs = cur_thread->u_block_desc;
     }
 
     // 若申请的内存不在内存池容量范围内则直接返回 NULL
-    if (!(size > 0 && size < pool_size)) {
+    if (!(size > 0 && size / PG_SIZE < frames.total_pages)) {
         return NULL;
     }
     struct arena* a;
     struct mem_block* b;
-    lock_acquire(&mem_pool->lock);
-
-    // 超过最大内存块 1024, 就分配页框
-    if (size > 1024) {
-        uint32_t page_cnt = DIV_ROUND_UP(size + sizeof(struct arena), PG_SIZE);
-
-        a = malloc_page(PF, page_cnt);
-
-        if (a != NULL) {
-            memset(a, 0, page_cnt*PG_SIZE); // 将分配的内存清零
-            // 对于分配的大块页框, 将 desc 置为 NULL, cnt 置为页框数, large 置为 true
-            a->desc = NULL;
-            a->cnt = page_cnt;
-            a->large = true;
-            lock_release(&mem_pool->lock);
-            return (void*)(a + 1); // 跨过 arena 大小, 把剩下的内存返回
+
+    // 超过最大内存块, 就分配页框, arena 放在页外, 所以整页的请求恰好占用相应的页数
+    if (size > descs[DESC_CNT - 1].block_size) {
+        uint32_t page_cnt = DIV_ROUND_UP(size, PG_SIZE);
+        void* vaddr;
+
+        pool_lock(mem_pool);
+        if (PF == PF_USER) {
+            // 用户进程的大块内存只登记区域, 各页首次访问时由缺页处理映射清零的页
+            vaddr = vaddr_get(PF_USER, page_cnt);
         } else {
-            lock_release(&mem_pool->lock);
+            vaddr = malloc_page_af(PF, page_cnt, AF_ZERO); // 分配清零的内存
+        }
+        if (vaddr == NULL) {
+            pool_unlock(mem_pool);
+            return NULL;
+        }
+        a = arena_meta_alloc(PF, (uint32_t)vaddr);
+        if (a == NULL) {
+            mfree_page(PF, vaddr, page_cnt);
+            pool_unlock(mem_pool);
             return NULL;
         }
-    } else { // 若申请的内存小于等于 1024, 可在各种规格的 mem_block_desc 中去适配
+        // 对于分配的大块页框, 将 desc 置为 NULL, cnt 置为页框数, large 置为 true
+        a->desc = NULL;
+        a->cnt = page_cnt;
+        a->large = true;
+        a->bytes = size;
+        mem_pool->large_cnt++;
+        mem_pool->large_pages += page_cnt;
+        mem_pool->large_bytes += size;
+        pool_unlock(mem_pool);
+        return vaddr;
+    } else { // 可在各种规格的 mem_block_desc 中去适配
         uint8_t desc_idx;
         // 从内存块描述符中匹配合适的内存块规格
         for (desc_idx = 0; desc_idx < DESC_CNT; desc_idx++) {
@@ -377,81 +963,85 @@ void* sys_malloc(uint32_t size) {	// size 申请的内存字节数
             }
         }
 
-        // 若 mem_block_desc 的 free_list 中已经没有可用的 mem_block
-        // 就创建新的 arena 提供 mem_block
-        if (list_empty(&descs[desc_idx].free_list)) {
-            a = malloc_page(PF, 1);
-            if (a == NULL) {
-                lock_release(&mem_pool->lock);
-                return NULL;
-            }
-            memset(a, 0, PG_SIZE);
-
-            // 对于分配的小块内存, 将 desc 置为相应内存块描述符
-            // cnt 置为 arena 可用的内存块数, large 置为 false
-            a->desc = &descs[desc_idx];
-            a->large = false;
-            a->cnt = descs[desc_idx].blocks_per_arena;
-            uint32_t block_idx;
-
-            enum intr_status old_status = intr_disable();
-
-            // 开始将 arena 拆分成内存块, 并添加到内存块描述符的 free_list 中
-            for (block_idx = 0; block_idx < descs[desc_idx].blocks_per_arena; block_idx++) {
-                b = arena2block(a, block_idx);
-                ASSERT(!elem_find(&a->desc->free_list, &b->free_elem));
-                list_append(&a->desc->free_list, &b->free_elem);
-            }
-            intr_set_status(old_status);
+        // 弹匣只由本任务访问, 不用加锁, 空了才批量从内存块描述符补充
+        struct mem_magazine* mag = &cur_thread->mags[desc_idx];
+        if (mag->cnt == 0 && magazine_refill(PF, mem_pool, descs, desc_idx, mag) == 0) {
+            return NULL;
         }
 
         // 开始分配内存块
-        b = elem2entry(struct mem_block, free_elem, list_pop(&(descs[desc_idx].free_list)));
+        b = mag->blocks[--mag->cnt];
         memset(b, 0, descs[desc_idx].block_size);
-
-        a = block2arena(b); // 获取内存块 b 所在的 arena
-        a->cnt--; // 将此 arena 中的空闲块数减 1
-        lock_release(&mem_pool->lock);
+        descs[desc_idx].alloc_cnt++;
+        descs[desc_idx].waste_bytes += descs[desc_idx].block_size - size;
         return (void*)b;
     }
 }
 
-// 将物理地址 pg_phy_addr 回收到物理内存池
+// 把物理页 pg_phy_addr 的引用计数减 1, 减到 0 时归还页框分配器, 并从所属内存池的占用中扣除
+// 需在关中断下调用
+static void pfree_intr_off(uint32_t pg_phy_addr) {
+    uint32_t bit_idx = (pg_phy_addr - frames.phy_addr_start) / PG_SIZE;
+    struct buddy_node* node = &frames.frame_buddy.nodes[bit_idx];
+    // 写时复制的页可能被多个进程共享, 引用计数减到 0 才真正释放
+    ASSERT(node->ref > 0);
+    if (--node->ref == 0) {
+        struct pool* mem_pool = node->owner == PF_KERNEL ? &kernel_pool : &user_pool;
+        mem_pool->pages--;
+        mem_pool->page_frees++;
+        buddy_free(&frames.frame_buddy, bit_idx, 0); // 归还伙伴系统, 并与空闲伙伴合并
+        if (frames.pressure && frames_free() > frames.wmark_high) {
+            frames.pressure = false;
+        }
+    }
+}
+
+// 将物理地址 pg_phy_addr 回收到页框分配器
 void pfree(uint32_t pg_phy_addr) {
-    struct pool* mem_pool;
-    uint32_t bit_idx = 0;
-    if (pg_phy_addr >= user_pool.phy_addr_start) { // 用户物理内存池
-        mem_pool = &user_pool;
-        bit_idx = (pg_phy_addr - user_pool.phy_addr_start) / PG_SIZE;
-    } else { // 内核内存池
-        mem_pool = &kernel_pool;
-        bit_idx = (pg_phy_addr - kernel_pool.phy_addr_start) / PG_SIZE;
+    enum intr_status old_status = intr_disable();
+    pfree_intr_off(pg_phy_addr);
+    intr_set_status(old_status);
+}
+
+// 一次归还 pg_phy_addrs 中的 cnt 个物理页, 整批只关一次中断
+static void pfree_batch(uint32_t* pg_phy_addrs, uint32_t cnt) {
+    enum intr_status old_status = intr_disable();
+    uint32_t idx = 0;
+    while (idx < cnt) {
+        pfree_intr_off(pg_phy_addrs[idx++]);
     }
-    bitmap_set(&mem_pool->pool_bitmap, bit_idx, 0); // 将位图中该位清 0
+    intr_set_status(old_status);
 }
 
 // 去掉页表中虚拟地址 vaddr 的映射, 只去掉 vaddr 对应的 pte
 static void page_table_pte_remove(uint32_t vaddr) {
     uint32_t* pte = pte_ptr(vaddr);
     *pte &= ~PG_P_1; // 将页表项 pte 的 P 位置 0
-    asm volatile ("invlpg %0" : : "m" (vaddr) : "memory"); // 更新 tlb
+    asm volatile ("invlpg %0" : : "m" (*(char*)vaddr) : "memory"); // 更新 tlb, 操作数须是 vaddr 所指的内存而不是变量本身
+}
+
+// 若用户地址 vaddr 所在的页已换出, 释放其交换槽并清除页表项, 调用者须持有 user_pool 的锁
+static void swap_entry_drop(uint32_t vaddr) {
+    if (*pde_ptr(vaddr) & PG_P_1) {
+        uint32_t* pte = pte_ptr(vaddr);
+        if (*pte & PG_SWAP) {
+            swap_slot_put(*pte >> 12);
+            *pte = 0;
+        }
+    }
 }
 
 // 在虚拟地址池中释放以 vaddr 起始的连续 pg_cnt 个虚拟页地址
 static void vaddr_remove(enum pool_flags pf, void* _vaddr, uint32_t pg_cnt) {
-    uint32_t bit_idx_start = 0, vaddr = (uint32_t)_vaddr, cnt = 0;
+    uint32_t bit_idx_start = 0, vaddr = (uint32_t)_vaddr;
 
     if (pf == PF_KERNEL) { // 内核虚拟内存池
         bit_idx_start = (vaddr - kernel_vaddr.vaddr_start) / PG_SIZE;
-        while (cnt < pg_cnt) {
-            bitmap_set(&kernel_vaddr.vaddr_bitmap, bit_idx_start+cnt++, 0);
-        }
-    } else { // 用户虚拟内存池
-        struct task_struct* cur_thread = running_thread();
-        bit_idx_start = (vaddr - cur_thread->userprog_vaddr.vaddr_start) / PG_SIZE;
-        while (cnt < pg_cnt) {
-            bitmap_set(&cur_thread->userprog_vaddr.vaddr_bitmap, bit_idx_start+cnt++, 0);
-        }
+        buddy_free_pages(&kernel_vaddr.vaddr_buddy, bit_idx_start, pg_cnt);
+    } else { // 用户虚拟内存池, 整段区域由 vaddr_get 登记, 这里整段注销
+        struct vm_area* vma = vma_find(running_thread(), vaddr);
+        ASSERT(vma != NULL && vma->start == vaddr && vma->end == vaddr + pg_cnt * PG_SIZE);
+        vma_remove(running_thread(), vma->start);
     }
 }
 
@@ -460,17 +1050,20 @@ void mfree_page(enum pool_flags pf, void* _vaddr, uint32_t pg_cnt) {
     uint32_t pg_phy_addr;
     uint32_t vaddr = (int32_t)_vaddr, page_cnt = 0;
     ASSERT((pg_cnt >= 1) && (vaddr % PG_SIZE) == 0);
-    pg_phy_addr = addr_v2p(vaddr); // 获取虚拟地址 vaddr 对应的物理地址
-    // 确保待释放的物理内存在低端 1MB+1KB 大小的页目录 + 1KB 大小的页表地址外
-    ASSERT((pg_phy_addr % PG_SIZE) == 0 && pg_phy_addr >= 0x102000);
-    // 判断 pg_phy_addr 属于用户物理内存池还是内核物理内存池
-    if (pg_phy_addr >= user_pool.phy_addr_start) { // 位于用户物理内存池
+    // 两个内存池的页框交错分布, 只能按 pf 区分
+    if (pf == PF_USER) { // 位于用户物理内存池, 页可能从未映射或已换出, 不能先查物理地址
         vaddr -= PG_SIZE;
         while (page_cnt < pg_cnt) {
             vaddr += PG_SIZE;
+            // 按需分配的页可能从未被访问过, 没有映射就跳过, 已换出的页只需释放交换槽
+            if (!page_mapped(vaddr)) {
+                swap_entry_drop(vaddr);
+                page_cnt++;
+                continue;
+            }
             pg_phy_addr = addr_v2p(vaddr);
             // 确保物理地址属于用户物理地址池
-            ASSERT((pg_phy_addr % PG_SIZE) == 0 && pg_phy_addr >= user_pool.phy_addr_start);
+            ASSERT((pg_phy_addr % PG_SIZE) == 0 && page_node(pg_phy_addr)->owner == PF_USER);
             // 先将对应的物理页框归还到内存池
             pfree(pg_phy_addr);
             // 再从页表中清楚此虚拟地址所在的页表项 pte
@@ -480,6 +1073,14 @@ void mfree_page(enum pool_flags pf, void* _vaddr, uint32_t pg_cnt) {
         }
         // 清空虚拟地址的位图中的相应位
         vaddr_remove(pf, _vaddr, pg_cnt);
+        return;
+    }
+    pg_phy_addr = addr_v2p(vaddr); // 获取虚拟地址 vaddr 对应的物理地址
+    // 确保待释放的物理内存在低端 1MB+1KB 大小的页目录 + 1KB 大小的页表地址外
+    ASSERT((pg_phy_addr % PG_SIZE) == 0 && pg_phy_addr >= 0x102000);
+    if (vaddr >= DMAP_BASE) { // 直接映射区中的内核页, 只需归还物理页
+        ASSERT(pg_cnt == 1 && page_node(pg_phy_addr)->owner == PF_KERNEL);
+        pfree(pg_phy_addr);
     } else { // 位于内核物理内存池
         vaddr -= PG_SIZE;
         while (page_cnt < pg_cnt) {
@@ -487,8 +1088,8 @@ void mfree_page(enum pool_flags pf, void* _vaddr, uint32_t pg_cnt) {
             pg_phy_addr = addr_v2p(vaddr);
             // 确保待释放的物理内存只属于内核物理地址池
             ASSERT((pg_phy_addr % PG_SIZE) == 0 && \
-                    pg_phy_addr >= kernel_pool.phy_addr_start && \
-                    pg_phy_addr < user_pool.phy_addr_start);
+                    pg_phy_addr >= frames.phy_addr_start && \
+                    page_node(pg_phy_addr)->owner == PF_KERNEL);
             // 先将对应的物理页框归还到内存池
             pfree(pg_phy_addr);
             // 再从页表中清除此虚拟地址所在的页表框 pte
@@ -507,39 +1108,190 @@ void sys_free(void* ptr) {
     if (ptr != NULL) {
         enum pool_flags PF;
         struct pool* mem_pool;
+        struct mem_block_desc* descs;
+        struct task_struct* cur_thread = running_thread();
 
         // 判断是线程, 还是进程
-        if (running_thread()->pgdir == NULL) {
+        if (cur_thread->pgdir == NULL) {
             ASSERT((uint32_t)ptr >= K_HEAP_START);
             PF = PF_KERNEL;
             mem_pool = &kernel_pool;
+            descs = k_block_descs;
         } else {
             PF = PF_USER;
             mem_pool = &user_pool;
+            descs = cur_thread->u_block_desc;
         }
 
-        lock_acquire(&mem_pool->lock);
         struct mem_block* b = ptr;
-        struct arena* a = block2arena(b); // 把 mem_block 转换成 arena, 获取元信息
+        struct arena* a = block2arena(PF, b); // 把 mem_block 转换成 arena, 获取元信息
         ASSERT(a->large == 0 || a->large == 1);
-        if (a->desc == NULL && a->large ==true) { // 大于 1024 的内存
-            mfree_page(PF, a, a->cnt);
-        } else { // 小于等于 1024 的内存块
-            // 先将内存块回收到 free_list
-            list_append(&a->desc->free_list, &b->free_elem);
-            // 再判断此 arena 中的内存块是否都是空闲, 如果是就释放 arena
-            if (++a->cnt == a->desc->blocks_per_arena) {
-                uint32_t block_idx;
-                for (block_idx = 0; block_idx < a->desc->blocks_per_arena; block_idx++) {
-                    struct mem_block* b = arena2block(a, block_idx);
-                    ASSERT(elem_find(&a->desc->free_list, &b->free_elem));
-                    list_remove(&b->free_elem);
-                }
-                mfree_page(PF, a, 1);
+        if (a->desc == NULL && a->large ==true) { // 大块内存, 只有这里要改动内存池
+            pool_lock(mem_pool);
+            uint32_t page_cnt = a->cnt;
+            ASSERT((uint32_t)ptr == a->base);
+            mem_pool->large_cnt--;
+            mem_pool->large_pages -= page_cnt;
+            mem_pool->large_bytes -= a->bytes;
+            arena_meta_free(PF, a);
+            mfree_page(PF, ptr, page_cnt);
+            pool_unlock(mem_pool);
+        } else { // 各规格的内存块, 只放进本任务的弹匣, 不用加锁
+            // fork 出的子进程中 a->desc 仍指向父进程的描述符, 父进程可能已退出, 只能按下标找本任务的规格
+            uint8_t desc_idx = a->desc_idx;
+            ASSERT(desc_idx < DESC_CNT);
+
+            // 先放回本任务的弹匣, 弹匣满了再批量归还到 free_list
+            struct mem_magazine* mag = &cur_thread->mags[desc_idx];
+            if (mag->cnt == MAG_SIZE) {
+                magazine_flush(PF, mem_pool, &descs[desc_idx], mag, MAG_BATCH);
             }
+            mag->blocks[mag->cnt++] = b;
+        }
+    }
+}
+
+// 释放进程堆中 [start, end) 内已分配的物理页
+static void heap_pages_release(uint32_t start, uint32_t end) {
+    uint32_t vaddr = start;
+    pool_lock(&user_pool);
+    while (vaddr < end) {
+        // 堆页按需分配, 从未访问过的页没有映射
+        if (page_mapped(vaddr)) {
+            pfree(addr_v2p(vaddr));
+            page_table_pte_remove(vaddr);
+        } else {
+            swap_entry_drop(vaddr);
         }
-        lock_release(&mem_pool->lock);
+        vaddr += PG_SIZE;
     }
+    pool_unlock(&user_pool);
+}
+
+// 把当前进程的堆末端调整为 addr, 成功返回新的堆末端, 失败时堆不变并返回原堆末端
+// addr 为 NULL 时只查询, 堆按整页增减, 新增的页在首次访问时才分配物理页
+void* sys_brk(void* addr) {
+    struct task_struct* cur = running_thread();
+    uint32_t new_brk = (uint32_t)addr;
+    if (cur->pgdir == NULL || new_brk == 0 || \
+        new_brk < cur->heap_start || new_brk > 0xc0000000 - USER_STACK_SIZE) {
+        return (void*)cur->heap_brk;
+    }
+
+    uint32_t old_end = DIV_ROUND_UP(cur->heap_brk, PG_SIZE) * PG_SIZE;
+    uint32_t new_end = DIV_ROUND_UP(new_brk, PG_SIZE) * PG_SIZE;
+    // 换出线程会遍历各进程的区域树, 修改区域要持有 user_pool 的锁
+    pool_lock(&user_pool);
+    struct vm_area* heap = vma_find(cur, cur->heap_start);
+
+    if (new_end > old_end) {
+        // 新增的地址不能已被其他区域占用
+        if (vma_intersect(cur, old_end, new_end) != NULL) {
+            pool_unlock(&user_pool);
+            return (void*)cur->heap_brk;
+        }
+        if (heap != NULL) {
+            heap->end = new_end;
+        } else if (!vma_add(cur, cur->heap_start, new_end, VMA_BRK)) {
+            pool_unlock(&user_pool);
+            return (void*)cur->heap_brk;
+        }
+    } else if (new_end < old_end) {
+        ASSERT(heap != NULL && heap->type == VMA_BRK);
+        heap_pages_release(new_end, old_end);
+        if (new_end == cur->heap_start) {
+            vma_remove(cur, cur->heap_start);
+        } else {
+            heap->end = new_end;
+        }
+    }
+    pool_unlock(&user_pool);
+    cur->heap_brk = new_brk;
+    return addr;
+}
+
+// 打印内存池 m_pool 的页使用情况, 持锁时取数, 放锁后再输出
+static void pool_print(const char* name, struct pool* m_pool) {
+    pool_lock(m_pool);
+    uint32_t pages = m_pool->pages, peak_pages = m_pool->peak_pages, moved_in = m_pool->moved_in;
+    uint32_t page_allocs = m_pool->page_allocs, page_frees = m_pool->page_frees;
+    uint32_t lock_kcycles = (uint32_t)(m_pool->lock_cycles >> 10);
+    pool_unlock(m_pool);
+    printk_stdout("%s  %d  %d  %d  %d  %d  %d\n", name, pages, peak_pages, moved_in, \
+                  page_allocs, page_frees, lock_kcycles);
+}
+
+// 打印 descs 各规格的 arena 数、空闲块数和内部碎片, 以及内存池 m_pool 中的大块内存
+// 内部碎片按累计的分配计算块大小与申请大小之差, 大块内存按当前未释放的计算
+// 输出可能写到文件或管道而阻塞, 持锁时只取数, 放锁后再输出
+static void desc_print(struct mem_block_desc* descs, struct pool* m_pool) {
+    uint32_t stat[DESC_CNT][5];
+    uint8_t desc_idx;
+    pool_lock(m_pool);
+    for (desc_idx = 0; desc_idx < DESC_CNT; desc_idx++) {
+        desc_relink(&descs[desc_idx]);
+        stat[desc_idx][0] = descs[desc_idx].block_size;
+        stat[desc_idx][1] = descs[desc_idx].arena_cnt;
+        stat[desc_idx][2] = list_len(&descs[desc_idx].free_list);
+        stat[desc_idx][3] = descs[desc_idx].alloc_cnt;
+        stat[desc_idx][4] = descs[desc_idx].waste_bytes;
+    }
+    uint32_t large_cnt = m_pool->large_cnt, large_pages = m_pool->large_pages, large_bytes = m_pool->large_bytes;
+    pool_unlock(m_pool);
+    printk_stdout("  SIZE  ARENAS  FREE  ALLOCS  WASTE\n");
+    for (desc_idx = 0; desc_idx < DESC_CNT; desc_idx++) {
+        printk_stdout("  %d  %d  %d  %d  %d\n", stat[desc_idx][0], stat[desc_idx][1], \
+                      stat[desc_idx][2], stat[desc_idx][3], stat[desc_idx][4]);
+    }
+    printk_stdout("  large: %d objects  %d pages  %d bytes  %d wasted\n", \
+                  large_cnt, large_pages, large_bytes, large_pages * PG_SIZE - large_bytes);
+}
+
+// list_traversal 的回调函数, 打印用户进程各规格的 arena 数
+static bool task_arena_print(struct list_elem* pelem, int arg) {
+    struct task_struct* pthread = elem2entry(struct task_struct, all_list_tag, pelem);
+    if (pthread->pgdir != NULL) {
+        char line[128];
+        uint32_t len = sprintf(line, "  %d %s:", pthread->pid, pthread->name);
+        uint8_t desc_idx;
+        for (desc_idx = 0; desc_idx < DESC_CNT; desc_idx++) {
+            len += sprintf(line + len, " %d", pthread->u_block_desc[desc_idx].arena_cnt);
+        }
+        printk_stdout("%s\n", line);
+    }
+    return false;
+}
+
+// 把内存使用情况写到标准输出: 页框与两个内存池的页, 交换分区与换入换出的页数, 内核与当前进程 sys_malloc 的各规格, 以及各进程的 arena 数
+// LARGEST 为一次能分配的最多连续页数, 相邻的最大阶块合起来计算, MOVED 为取自另一个内存池释放的页数
+// LOCK 为累计持有内存池锁的时间, 单位为 1024 个时钟周期
+void sys_meminfo(void) {
+    struct task_struct* cur = running_thread();
+    struct buddy* b = &frames.frame_buddy;
+    uint32_t largest = buddy_max_free_run(b);
+    enum intr_status old_status = intr_disable();
+    uint32_t free_pages = b->free_pages;
+    uint32_t zero_cnt = frames.zero_cnt;
+    bool pressure = frames.pressure;
+    intr_set_status(old_status);
+    printk_stdout("FRAMES  PAGES  FREE  ZEROED  LARGEST  MIN  LOW  HIGH\n");
+    printk_stdout("  %d  %d  %d  %d  %d  %d  %d\n", frames.total_pages, free_pages, zero_cnt, \
+                  largest, frames.wmark_min, frames.wmark_low, frames.wmark_high);
+    printk_stdout("pressure: %s, entered %d times, %d user pages denied for kernel reserve\n", \
+                  pressure ? "yes" : "no", frames.pressure_cnt, frames.reserve_denied);
+    swap_info_print();
+    printk_stdout("swapper: woken %d times, %d direct reclaims\n", frames.swapper_runs, frames.direct_reclaims);
+    printk_stdout("POOL  PAGES  PEAK  MOVED  ALLOCS  FREES  LOCK(Kcyc)\n");
+    pool_print("kernel", &kernel_pool);
+    pool_print("user", &user_pool);
+    printk_stdout("kernel malloc:\n");
+    desc_print(k_block_descs, &kernel_pool);
+    if (cur->pgdir != NULL) {
+        printk_stdout("%s malloc:\n", cur->name);
+        desc_print(cur->u_block_desc, &user_pool);
+    }
+    printk_stdout("process arenas per size class:\n");
+    list_traversal(&thread_all_list, task_arena_print, 0);
 }
 
 void block_desc_init(struct mem_block_desc* desc_array) {
@@ -549,9 +1301,17 @@ void block_desc_init(struct mem_block_desc* desc_array) {
     for (desc_idx = 0; desc_idx < DESC_CNT; desc_idx++) {
         desc_array[desc_idx].block_size = block_size;
 
-        // 初始化 arena 中的内存块数量
-        desc_array[desc_idx].blocks_per_arena = (PG_SIZE - sizeof(struct arena)) / block_size;
+        // 初始化 arena 中的内存块数量, 大规格的 arena 在页外, 整页都可用
+        if (block_size > ARENA_INPAGE_MAX) {
+            desc_array[desc_idx].blocks_per_arena = PG_SIZE / block_size;
+        } else {
+            desc_array[desc_idx].blocks_per_arena = (PG_SIZE - sizeof(struct arena)) / block_size;
+        }
         list_init(&desc_array[desc_idx].free_list);
+        desc_array[desc_idx].inherited = false;
+        desc_array[desc_idx].arena_cnt = 0;
+        desc_array[desc_idx].alloc_cnt = 0;
+        desc_array[desc_idx].waste_bytes = 0;
         block_size *= 2; // 更新为下一个规格内存块
     }
 }
@@ -559,39 +1319,494 @@ void block_desc_init(struct mem_block_desc* desc_array) {
 /* 安装1页大小的vaddr,专门针对fork时虚拟地址位图无须操作的情况 */
 void* get_a_page_without_opvaddrbitmap(enum pool_flags pf, uint32_t vaddr) {
    struct pool* mem_pool = pf & PF_KERNEL ? &kernel_pool : &user_pool;
-   lock_acquire(&mem_pool->lock);
-   void* page_phyaddr = palloc(mem_pool);
+   bool zeroed;
+   pool_lock(mem_pool);
+   void* page_phyaddr = pf == PF_USER ? user_palloc(AF_NOZERO, &zeroed) : palloc(mem_pool);
    if (page_phyaddr == NULL) {
-      lock_release(&mem_pool->lock);
+      pool_unlock(mem_pool);
       return NULL;
    }
    page_table_add((void*)vaddr, page_phyaddr); 
-   lock_release(&mem_pool->lock);
+   pool_unlock(mem_pool);
    return (void*)vaddr;
 }
 
-// 根据物理页框地址 pg_phy_addr 在相应的内存池的位图清 0，不改动页表
+// 根据物理页框地址 pg_phy_addr 将其归还相应内存池的伙伴系统，不改动页表
 void free_a_phy_page(uint32_t pg_phy_addr) {
-    struct pool* mem_pool;
-    uint32_t bit_idx = 0;
-    if (pg_phy_addr >= user_pool.phy_addr_start) {
-        mem_pool = &user_pool;
-        bit_idx = (pg_phy_addr - user_pool.phy_addr_start) / PG_SIZE;
+    pfree(pg_phy_addr);
+}
+
+
+// 由 idle 线程调用, 在后台把空闲页清零后放入预清零页池, 紧张状态下不再补充
+// idle 线程不能被锁阻塞, 因此只用伙伴系统和关中断, 不申请内存池的锁
+void zero_pages_fill(void) {
+    uint32_t budget = ZERO_FILL_BATCH;
+    while (budget > 0 && !frames.pressure && frames.zero_cnt < ZERO_POOL_PAGES) {
+        int32_t page_idx = buddy_alloc(&frames.frame_buddy, 0);
+        if (page_idx == -1) {
+            return;
+        }
+        // 直接映射区以外的页通过清零窗口访问, 窗口只有 idle 线程使用
+        uint32_t pg_phy_addr = frames.phy_addr_start + page_idx * PG_SIZE;
+        void* page = kmap(KMAP_ZERO, pg_phy_addr);
+        memset(page, 0, PG_SIZE);
+        kunmap(page);
+
+        enum intr_status old_status = intr_disable();
+        if (frames.zero_cnt < ZERO_POOL_PAGES) {
+            frames.zero_pages[frames.zero_cnt++] = pg_phy_addr;
+        } else {
+            buddy_free(&frames.frame_buddy, page_idx, 0);
+        }
+        intr_set_status(old_status);
+        budget--;
+    }
+}
+
+// fork 时把当前进程用户空间中已映射的页以写时复制的方式共享给页目录 child_pgdir
+// 可写的页在父子进程中都改为只读并标记 PG_COW, 物理页的引用计数加 1, 已换出的页共享交换槽
+// 子进程的页表通过临时窗口填写, 必须在关中断下调用, 成功返回 true
+bool user_pages_share(uint32_t* child_pgdir) {
+    ASSERT(intr_get_status() == INTR_OFF);
+    uint32_t* parent_pgdir = running_thread()->pgdir;
+    uint32_t pde_idx, pte_idx;
+    for (pde_idx = 0; pde_idx < 768; pde_idx++) {
+        if (!(parent_pgdir[pde_idx] & PG_P_1)) {
+            continue;
+        }
+        uint32_t pt_phy_addr = (uint32_t)palloc(&kernel_pool);
+        if (pt_phy_addr == 0) {
+            return false;
+        }
+        uint32_t* parent_pt = pte_ptr(pde_idx << 22);
+        uint32_t* child_pt = kmap(KMAP_COPY, pt_phy_addr);
+        for (pte_idx = 0; pte_idx < 1024; pte_idx++) {
+            uint32_t pte = parent_pt[pte_idx];
+            if (pte & PG_P_1) {
+                if (pte & PG_RW_W) {
+                    pte = (pte & ~PG_RW_W) | PG_COW;
+                    parent_pt[pte_idx] = pte;
+                }
+                page_node(pte & 0xfffff000)->ref++;
+            } else if (pte & PG_SWAP) {
+                swap_slot_dup(pte >> 12);
+            }
+            child_pt[pte_idx] = pte;
+        }
+        kunmap(child_pt);
+        child_pgdir[pde_idx] = pt_phy_addr | PG_US_U | PG_RW_W | PG_P_1;
+    }
+    // 父进程的页表项改成了只读, 重新加载 cr3 使 tlb 失效, 整个 fork 只刷新这一次
+    asm volatile ("movl %%cr3, %%eax; movl %%eax, %%cr3" : : : "eax", "memory");
+    return true;
+}
+
+// 撤销 fork 中途失败的 user_pages_share: 归还子进程 child 已共享的页、交换槽、页表和区域树
+// 父进程中已无其它进程共享的写时复制页恢复为可写, 在父进程的上下文中关中断调用
+void user_pages_unshare(struct task_struct* child) {
+    ASSERT(intr_get_status() == INTR_OFF);
+    user_pages_release(child);
+    uint32_t* parent_pgdir = running_thread()->pgdir;
+    uint32_t pde_idx, pte_idx;
+    pool_lock(&user_pool);
+    for (pde_idx = 0; pde_idx < 768; pde_idx++) {
+        if (!(parent_pgdir[pde_idx] & PG_P_1)) {
+            continue;
+        }
+        uint32_t* parent_pt = pte_ptr(pde_idx << 22);
+        for (pte_idx = 0; pte_idx < 1024; pte_idx++) {
+            uint32_t pte = parent_pt[pte_idx];
+            if ((pte & PG_P_1) && (pte & PG_COW) && page_node(pte & 0xfffff000)->ref == 1) {
+                parent_pt[pte_idx] = (pte & ~PG_COW) | PG_RW_W;
+            }
+        }
+    }
+    pool_unlock(&user_pool);
+    asm volatile ("movl %%cr3, %%eax; movl %%eax, %%cr3" : : : "eax", "memory");
+}
+
+// 释放进程 pthread 用户空间的所有页、交换槽、区域树及页表, 共享的写时复制页只减少引用计数
+// 用户页只可能映射在已登记的区域中, 因此只按区域查看实际用到的页表项, 不必扫描整个用户空间
+// 页框攒够一批再归还, 整个过程只申请一次内存池的锁; 页表通过 kmap 访问, pthread 不必是当前进程
+// 区域树在持有 user_pool 的锁时释放, 换出线程拿到锁后看到的区域树要么完整要么为空
+void user_pages_release(struct task_struct* pthread) {
+    uint32_t* pgdir = pthread->pgdir;
+    uint32_t batch[RELEASE_BATCH];
+    uint32_t cnt = 0;
+    uint32_t vaddr = 0;
+    struct vm_area* vma;
+
+    pool_lock(&user_pool);
+    while ((vma = vma_next(pthread, vaddr)) != NULL) {
+        vaddr = vma->start;
+        // 区域可能跨多个页表, 逐个页表处理其中属于区域的页表项
+        while (vaddr < vma->end) {
+            uint32_t pde_idx = PDE_IDX(vaddr);
+            uint32_t end = (pde_idx + 1) << 22;
+            if (end > vma->end) {
+                end = vma->end;
+            }
+            if (pgdir[pde_idx] & PG_P_1) {
+                // 临时窗口在关中断下使用, 每个页表只关一次中断
+                enum intr_status old_status = intr_disable();
+                uint32_t* pt = kmap(KMAP_COPY, pgdir[pde_idx] & 0xfffff000);
+                uint32_t pte_idx = PTE_IDX(vaddr);
+                uint32_t pte_end = PTE_IDX((end - 1)) + 1;
+                while (pte_idx < pte_end) {
+                    if (pt[pte_idx] & PG_P_1) {
+                        batch[cnt++] = pt[pte_idx] & 0xfffff000;
+                        if (cnt == RELEASE_BATCH) {
+                            pfree_batch(batch, cnt);
+                            cnt = 0;
+                        }
+                    } else if (pt[pte_idx] & PG_SWAP) {
+                        swap_slot_put(pt[pte_idx] >> 12);
+                    }
+                    pte_idx++;
+                }
+                kunmap(pt);
+                intr_set_status(old_status);
+            }
+            vaddr = end;
+        }
+    }
+    pfree_batch(batch, cnt);
+    vma_release(pthread);
+    pool_unlock(&user_pool);
+    swap_reap();    // 释放的交换槽若在压缩存储中, 在此归还其内存
+
+    // 页表不随区域释放, 区域之外也可能留有页表, 只能查看全部用户页目录项, 但不用再看页表项
+    cnt = 0;
+    pool_lock(&kernel_pool);
+    uint32_t pde_idx;
+    for (pde_idx = 0; pde_idx < 768; pde_idx++) {
+        if (pgdir[pde_idx] & PG_P_1) {
+            batch[cnt++] = pgdir[pde_idx] & 0xfffff000;
+            pgdir[pde_idx] = 0;
+            if (cnt == RELEASE_BATCH) {
+                pfree_batch(batch, cnt);
+                cnt = 0;
+            }
+        }
+    }
+    pfree_batch(batch, cnt);
+    pool_unlock(&kernel_pool);
+}
+
+// 时钟指针所找进程的候选, list_traversal 的参数
+struct clock_pick {
+    pid_t from;                 // 从此 pid 开始找
+    struct task_struct* next;   // 有用户页且 pid 不小于 from 的进程中 pid 最小者
+    struct task_struct* first;  // 有用户页的进程中 pid 最小者, 用于绕回
+};
+
+// list_traversal 的回调函数, 按 pid 为时钟指针挑选下一个进程
+static bool clock_task_pick(struct list_elem* pelem, int arg) {
+    struct clock_pick* pick = (struct clock_pick*)arg;
+    struct task_struct* pthread = elem2entry(struct task_struct, all_list_tag, pelem);
+    if (pthread->pgdir == NULL || pthread->vma_root == NULL) {
+        return false;
+    }
+    if (pthread->pid >= pick->from && (pick->next == NULL || pthread->pid < pick->next->pid)) {
+        pick->next = pthread;
+    }
+    if (pick->first == NULL || pthread->pid < pick->first->pid) {
+        pick->first = pthread;
+    }
+    return false;
+}
+
+// 返回时钟指针所指的进程, 该进程已退出时前进到 pid 更大的进程, 到头后绕回, 需关中断调用
+// 指针只记 pid 和地址, 不保存任何指针, 扫描之间进程退出或区域变动都不会留下悬空的引用
+static struct task_struct* clock_task(void) {
+    struct clock_pick pick = {clock_hand.pid, NULL, NULL};
+    list_traversal(&thread_all_list, clock_task_pick, (int)&pick);
+    if (pick.next == NULL) {
+        pick.next = pick.first;
+    }
+    if (pick.next != NULL && pick.next->pid != clock_hand.pid) {
+        clock_hand.pid = pick.next->pid;
+        clock_hand.vaddr = 0;
+    }
+    return pick.next;
+}
+
+// 从时钟指针处起扫描一个页表内属于区域的页, 访问位为 1 的页清除访问位, 给它第二次机会
+// 访问位为 0 的页选为换出对象, 页表项立即改为换出项, 物理页存入 victims, 交换槽存入 slots
+// 每检查一个可换出的页及每个页表都消耗 1 点 *budget, 返回选中的页数; 需关中断并持有 user_pool 的锁调用
+// 写时复制共享的页不换出; 修改后 invlpg 当前 tlb 即可, 切换到其它进程时非全局页都会刷出 tlb
+static uint32_t clock_scan(uint32_t* victims, uint32_t* slots, uint32_t want, uint32_t* budget) {
+    struct task_struct* pthread = clock_task();
+    if (pthread == NULL) {
+        *budget = 0;
+        return 0;
+    }
+    struct vm_area* vma = vma_find(pthread, clock_hand.vaddr);
+    if (vma == NULL) {
+        vma = vma_next(pthread, clock_hand.vaddr);
+        (*budget)--;
+        if (vma == NULL) { // 本进程已扫描完, 转到下一个进程
+            clock_hand.pid = pthread->pid + 1;
+            clock_hand.vaddr = 0;
+            return 0;
+        }
+        clock_hand.vaddr = vma->start;
+    }
+    uint32_t vaddr = clock_hand.vaddr;
+    uint32_t pde_idx = PDE_IDX(vaddr);
+    uint32_t end = (pde_idx + 1) << 22;
+    if (end > vma->end) {
+        end = vma->end;
+    }
+    if (!(pthread->pgdir[pde_idx] & PG_P_1)) {
+        clock_hand.vaddr = end;
+        (*budget)--;
+        return 0;
+    }
+
+    uint32_t found = 0;
+    uint32_t* pt = kmap(KMAP_COPY, pthread->pgdir[pde_idx] & 0xfffff000);
+    while (vaddr < end && found < want && *budget > 0) {
+        uint32_t* pte = &pt[PTE_IDX(vaddr)];
+        if ((*pte & PG_P_1) && page_node(*pte & 0xfffff000)->ref == 1) {
+            (*budget)--;
+            if (*pte & PG_A) {
+                *pte &= ~PG_A;
+                asm volatile ("invlpg %0" : : "m" (*(char*)vaddr) : "memory");
+            } else {
+                uint32_t slot = swap_slot_alloc();
+                if (slot == 0) { // 交换分区已满
+                    *budget = 0;
+                    break;
+                }
+                victims[found] = *pte & 0xfffff000;
+                slots[found++] = slot;
+                *pte = (slot << 12) | (*pte & (PG_COW | PG_US_U | PG_RW_W)) | PG_SWAP;
+                asm volatile ("invlpg %0" : : "m" (*(char*)vaddr) : "memory");
+            }
+        }
+        vaddr += PG_SIZE;
+    }
+    kunmap(pt);
+    clock_hand.vaddr = vaddr;
+    return found;
+}
+
+// 用时钟算法换出至多 want 个用户页, 返回换出的页数, 会阻塞在硬盘上
+// 选中的页先改为换出项再写盘, 整个过程持有 user_pool 的锁, 换入也要拿这把锁, 因此不会读到未写完的槽
+// 扫描两圈后每个页都已得到过第二次机会, 预算按此估算, 另为每个页表留出 1 点以保证扫描结束
+static uint32_t swap_out_pages(uint32_t want) {
+    uint32_t victims[SWAP_CLUSTER], slots[SWAP_CLUSTER];
+    uint32_t cnt = 0, idx;
+    if (want > SWAP_CLUSTER) {
+        want = SWAP_CLUSTER;
+    }
+    if (!swap_available()) {
+        return 0;
+    }
+    pool_lock(&user_pool);
+    uint32_t budget = user_pool.pages * 2 + 768;
+    while (cnt < want && budget > 0) {
+        enum intr_status old_status = intr_disable();
+        cnt += clock_scan(victims + cnt, slots + cnt, want - cnt, &budget);
+        intr_set_status(old_status);
+    }
+    for (idx = 0; idx < cnt; idx++) {
+        void* page = kmap(KMAP_SWAP, victims[idx]);
+        swap_write(slots[idx], page);
+        kunmap(page);
+    }
+    pfree_batch(victims, cnt);
+    pool_unlock(&user_pool);
+    return cnt;
+}
+
+// 换出线程: 空闲页低于低水位进入紧张状态时被唤醒, 换出用户页直到空闲页回升到高水位以上
+// 交换分区用尽或没有可换出的页时提前停下, 等到再次进入紧张状态或拒绝用户页时再被唤醒
+static void swapper(void* arg /*UNUSED*/) {
+    while (1) {
+        enum intr_status old_status = intr_disable();
+        swapper_idle = true;
+        thread_block(TASK_BLOCKED);
+        intr_set_status(old_status);
+        frames.swapper_runs++;
+        while (frames.pressure) {
+            if (swap_out_pages(SWAP_CLUSTER) == 0) {
+                break;
+            }
+        }
+    }
+}
+
+// 创建换出线程, 由 swap_init 在找到交换分区后调用
+void swapper_start(void) {
+    swapper_thread = thread_start("swapper", SWAPPER_PRIO, swapper, NULL);
+}
+
+// 处理对写时复制页 vaddr 的写操作, 在关中断的缺页处理中调用, 成功返回 true
+// 等锁时该页可能已被换出, 此时直接返回, 再次访问时先换入
+// 持有锁期间共享的页引用计数不会减少, 就地换出也就不会选中它
+static bool cow_page_copy(uint32_t vaddr) {
+    vaddr &= 0xfffff000;
+    uint32_t* pte = pte_ptr(vaddr);
+    pool_lock(&user_pool);
+    if (!(*pte & PG_P_1)) {
+        pool_unlock(&user_pool);
+        return true;
+    }
+    if (page_node(*pte & 0xfffff000)->ref == 1) {
+        // 其它进程都已不再使用该页, 直接恢复可写
+        *pte = (*pte & ~PG_COW) | PG_RW_W;
     } else {
-        mem_pool = &kernel_pool;
-        bit_idx = (pg_phy_addr - kernel_pool.phy_addr_start) / PG_SIZE;
+        bool zeroed;
+        uint32_t new_phy_addr = (uint32_t)user_palloc(AF_NOZERO, &zeroed);
+        if (new_phy_addr == 0) {
+            pool_unlock(&user_pool);
+            return false;
+        }
+        uint32_t old_phy_addr = *pte & 0xfffff000;
+        void* new_page = kmap(KMAP_COPY, new_phy_addr);
+        memcpy(new_page, (void*)vaddr, PG_SIZE);
+        kunmap(new_page);
+        *pte = new_phy_addr | PG_US_U | PG_RW_W | PG_P_1;
+        pfree(old_phy_addr);
+    }
+    asm volatile ("invlpg %0" : : "m" (*(char*)vaddr) : "memory");
+    pool_unlock(&user_pool);
+    return true;
+}
+
+// 把已换出的用户页 vaddr 换入, 在关中断的缺页处理中调用, 会阻塞在硬盘上, 成功返回 true
+// 换出线程在页写入交换槽之前一直持有 user_pool 的锁, 因此拿到锁后槽中的内容一定完整
+static bool swap_in_page(uint32_t vaddr) {
+    vaddr &= 0xfffff000;
+    uint32_t* pte = pte_ptr(vaddr);
+    bool zeroed;
+    pool_lock(&user_pool);
+    uint32_t page_phyaddr = (uint32_t)user_palloc(AF_NOZERO, &zeroed);
+    if (page_phyaddr == 0) {
+        pool_unlock(&user_pool);
+        return false;
+    }
+    // fork 只会共享交换槽而不会改动本进程的换出项, 槽号在读盘期间保持不变
+    uint32_t slot = *pte >> 12;
+    void* page = kmap(KMAP_SWAP, page_phyaddr);
+    swap_read(slot, page);
+    kunmap(page);
+    // 换出项保留了原来的读写和写时复制属性
+    *pte = page_phyaddr | (*pte & (PG_COW | PG_US_U | PG_RW_W)) | PG_P_1;
+    asm volatile ("invlpg %0" : : "m" (*(char*)vaddr) : "memory");
+    swap_slot_put(slot);
+    pool_unlock(&user_pool);
+    return true;
+}
+
+// 缺页异常处理, vec_nr 是 kernel.S 压入的中断号, 它所在的位置就是中断栈 intr_stack 的起始
+static void page_fault_handler(uint32_t vec_nr) {
+    struct intr_stack* frame = (struct intr_stack*)&vec_nr;
+    struct task_struct* cur = running_thread();
+    uint32_t vaddr;
+    // cr2 存放造成缺页的地址
+    asm volatile ("movl %%cr2, %0" : "=r" (vaddr));
+
+    // 写用户空间中的写时复制页, 为本进程复制一份可写的页
+    if (cur->pgdir != NULL && vaddr < 0xc0000000 && \
+        (frame->err_code & PF_ERR_P) && (frame->err_code & PF_ERR_W) && \
+        (*pte_ptr(vaddr) & PG_COW)) {
+        if (cow_page_copy(vaddr)) {
+            cur->min_flt++;
+            return;
+        }
+        printk("%s: out of memory at 0x%x\n", cur->name, vaddr);
+    }
+
+    // 已换出到交换分区的页, 从交换槽读回, 失败时不能再当作新页分配
+    bool swapped = cur->pgdir != NULL && vaddr >= USER_VADDR_START && vaddr < 0xc0000000 && \
+                   !(frame->err_code & PF_ERR_P) && (*pde_ptr(vaddr) & PG_P_1) && \
+                   (*pte_ptr(vaddr) & PG_SWAP);
+    if (swapped) {
+        if (swap_in_page(vaddr)) {
+            cur->maj_flt++;
+            return;
+        }
+        printk("%s: out of memory at 0x%x\n", cur->name, vaddr);
+    }
+
+    // 用户空间中不存在的页, 若位于已登记的区域内, 就分配清零的页
+    if (!swapped && cur->pgdir != NULL && vaddr >= USER_VADDR_START && vaddr < 0xc0000000 && \
+        !(frame->err_code & PF_ERR_P) && vma_find(cur, vaddr) != NULL) {
+        if (map_zeroed_user_page(vaddr) != NULL) {
+            cur->min_flt++;
+            return;
+        }
+        printk("%s: out of memory at 0x%x\n", cur->name, vaddr);
+    }
+
+    // 用户态的非法访问只结束该进程
+    if (frame->err_code & PF_ERR_U) {
+        printk("%s: segmentation fault at 0x%x\n", cur->name, vaddr);
+        sys_exit(-1);
     }
-    bitmap_set(&mem_pool->pool_bitmap, bit_idx, 0);
+
+    // 内核自身的缺页无法恢复
+    put_str("\npage fault addr is "); put_int(vaddr); put_str("\n");
+    PANIC("page fault in kernel");
 }
 
+// 开启或关闭 cr4 的 PGE 位, 关闭时全局页也会随 cr3 的加载刷出 tlb, 处理器不支持时返回 false
+// 改变 PGE 位会刷新整个 tlb, 包括全局页
+bool global_pages_set(bool enable) {
+    if (!pge_supported) {
+        return false;
+    }
+    uint32_t cr4;
+    asm volatile ("movl %%cr4, %0" : "=r" (cr4));
+    cr4 = enable ? cr4 | CR4_PGE : cr4 & ~CR4_PGE;
+    asm volatile ("movl %0, %%cr4" : : "r" (cr4) : "memory");
+    return true;
+}
+
+// 把 loader 建立的低端 1MB 内核映射标记为全局页, 并开启全局页
+// 此后内核通过 page_table_add、kmap 和直接映射区添加的映射都带有 PG_G
+static void global_pages_init(void) {
+    pge_supported = (cpuid_features() & CPUID_PGE) != 0;
+    if (!pge_supported) {
+        return;
+    }
+    uint32_t vaddr = 0xc0000000;
+    while (vaddr < K_HEAP_START) {
+        if (*pte_ptr(vaddr) & PG_P_1) {
+            *pte_ptr(vaddr) |= PG_G;
+        }
+        vaddr += PG_SIZE;
+    }
+    global_pages_set(true);
+}
 
 //内存管理部分初始化入口
 void mem_init(){
 	put_str("mem_init start\n");
-	uint32_t mem_bytes_total = (*(uint32_t*)(0xb00)); 
-    put_str("mem_bytes_total: 0x"); put_int(mem_bytes_total);put_str("\n");
-	mem_pool_init(mem_bytes_total);
+	uint32_t mem_bytes_total = (*(uint32_t*)(TOTAL_MEM_BYTES_ADDR)); 
+	uint32_t ards_nr = *(uint16_t*)ARDS_NR_ADDR;
+	if(ards_nr > ARDS_MAX){
+		ards_nr = ARDS_MAX;
+	}
+    put_str("mem_bytes_total: 0x"); put_int(mem_bytes_total);
+    put_str("   ards_nr: "); put_int(ards_nr); put_str("\n");
+	mem_pool_init((struct ards*)ARDS_BUF_ADDR, ards_nr, mem_bytes_total);
     // 初始化 mem_block_desc 数组 descs, 为 malloc 做准备
     block_desc_init(k_block_descs);
+    // 初始化对象缓存, 之后才能创建各类内核对象的 kmem_cache
+    kmem_cache_init();
+    uint32_t bucket = 0;
+    while (bucket < META_HASH_CNT) {
+        list_init(&meta_hash[bucket++]);
+    }
+    meta_cache = kmem_cache_create("arena_meta", sizeof(struct arena_meta), 0, NULL);
+    global_pages_init();
+    // 安装缺页异常处理程序
+    register_handler(0x0e, page_fault_handler);
+    // 置 cr0 的 WP 位, 使内核写用户只读页时同样引发缺页, 否则系统调用会直接写入共享的写时复制页
+    asm volatile ("movl %%cr0, %%eax; orl $0x10000, %%eax; movl %%eax, %%cr0" : : : "eax", "memory");
 	put_str("mem_init done\n"); 
 }
@@ -9,17 +9,33 @@ enum pool_flags{
 	PF_USER = 2	//用户内存池
 };
 
+/*申请页框时对内容的要求*/
+enum alloc_flags{
+	AF_ZERO = 0,	//返回的内存须清零
+	AF_NOZERO = 1	//调用者会覆盖整块内存, 不必清零
+};
+
 #define PG_P_1	1	//页表项或页目录项存在属性位
 #define PG_P_0	0	//页表项或页目录项存在属性位
 #define PG_RW_R	0	//R/W 属性位值，读/执行
 #define PG_RW_W	2	//R/W 属性位值，读/写/执行
 #define PG_US_S	0	//U/S 属性位值，系统级
 #define PG_US_U 4	//U/S 属性位值，用户级
+#define PG_A 0x20	//访问位，处理器访问该页时置 1，换出时据此给页第二次机会
+#define PG_PS 0x80	//页目录项中的 PS 位，为 1 时直接映射 4MB 大页，需开启 cr4 的 PSE 位
+#define PG_G 0x100	//全局页，cr4 的 PGE 位开启后，加载 cr3 不会把它刷出 tlb，只用于内核空间
+#define PG_COW 0x200	//页表项中留给软件使用的位，标记写时复制页
+#define PG_SWAP 0x400	//页表项中留给软件使用的位，P 位为 0 时表示页已换出，高 20 位是交换槽号
 
-/*虚拟地址池， 用于虚拟地址管理*/
-struct virtual_addr{
-	struct bitmap vaddr_bitmap;	//虚拟地址用到的位图结构
-	uint32_t vaddr_start;		//虚拟地址起始地址
+#define DMAP_BASE 0xf0000000	//直接映射区的起始虚拟地址，物理地址 0 映射于此
+#define DMAP_LIMIT 0x0f800000	//直接映射的物理内存上限，映射区止于 0xff800000，之后 loader 建好的最后一个页表留给共享数据页等固定映射
+
+/*临时映射窗口，每种用途独占一个，访问直接映射区以外的物理页时使用*/
+enum kmap_slot{
+	KMAP_ZERO,	//idle 线程清零空闲页
+	KMAP_COPY,	//fork 填写子进程页表、写时复制拷贝页、释放及扫描进程页表，都在关中断下进行
+	KMAP_SWAP,	//换入换出时读写页的内容，期间会阻塞在硬盘上，持有 user_pool 的锁时使用
+	KMAP_CNT
 };
 
 
@@ -33,14 +49,42 @@ struct mem_block_desc {
     uint32_t block_size; // 内存块大小
     uint32_t blocks_per_arena; // 本 arena 中可容纳此 mem_block 的数量
     struct list free_list; // 目前可用的 mem_block 链表
+    uint32_t arena_cnt; // 本规格的 arena 数
+    uint32_t alloc_cnt; // 累计分配出去的内存块数
+    uint32_t waste_bytes; // 累计的内部碎片, 即块大小与申请大小之差的总和
+    bool inherited; // fork 时从父进程复制而来, free_list 的首尾节点还指向父进程的链表头尾
 };
 
-#define DESC_CNT 7 // 内存块描述符个数
+// 内存仓库 arena 元信息
+// 不超过 ARENA_INPAGE_MAX 的规格, arena 放在页首, 其后是内存块
+// 更大的规格和大块内存要整页使用, arena 放在页外, 见 memory.c 中的 arena_meta
+struct arena {
+    struct mem_block_desc* desc;
+    // large 为 true 时, cnt 表示的是页框数
+    // 否则 cnt 表示空闲 mem_block 数量
+    uint32_t cnt;
+    bool large;
+    uint8_t desc_idx; // 小块内存的规格在内存块描述符数组中的下标
+    uint32_t base;  // 第一个内存块或大块内存的起始地址, 为 0 表示不是 arena
+    uint32_t bytes; // 大块内存实际申请的字节数
+};
+
+#define DESC_CNT 9 // 内存块描述符个数, 规格为 16 字节到 4KB
+#define ARENA_INPAGE_MAX 1024 // arena 放在页首的最大规格
+#define MAG_SIZE 8  // 每个弹匣最多缓存的内存块数
+#define MAG_BATCH 4 // 弹匣每次批量补充或归还的内存块数
+
+// 内存块弹匣, 每个任务每种规格一个, 缓存已从 arena 取出的空闲内存块
+struct mem_magazine {
+    uint32_t cnt;                       // 弹匣中的内存块数
+    struct mem_block* blocks[MAG_SIZE]; // 按放入顺序排列, 栈顶最热
+};
 
 extern int page_table_add_num;
 extern struct pool kernel_pool, user_pool;
 void mem_init(void);
 void* get_kernel_pages(uint32_t pg_cnt);
+void* get_kernel_pages_af(uint32_t pg_cnt, enum alloc_flags af);
 void* malloc_page(enum pool_flags pf, uint32_t pg_cnt);
 void malloc_init(void);
 uint32_t* pte_ptr(uint32_t vaddr);
@@ -53,7 +97,20 @@ void* sys_malloc(uint32_t size);
 void mfree_page(enum pool_flags pf, void* _vaddr, uint32_t pg_cnt);
 void pfree(uint32_t pg_phy_addr);
 void sys_free(void* ptr);
+void* sys_brk(void* addr);
 void* get_a_page_without_opvaddrbitmap(enum pool_flags pf, uint32_t vaddr);
 void free_a_phy_page(uint32_t pg_phy_addr);
+void magazine_drain(struct mem_magazine* mags);
+void sys_meminfo(void);
+void zero_pages_fill(void);
+bool page_mapped(uint32_t vaddr);
+bool user_pages_share(uint32_t* child_pgdir);
+struct task_struct;
+void user_pages_unshare(struct task_struct* child);
+void user_pages_release(struct task_struct* pthread);
+void* kmap(enum kmap_slot slot, uint32_t pg_phy_addr);
+void kunmap(void* vaddr);
+bool global_pages_set(bool enable);
+void swapper_start(void);
 #endif
 
@@ -0,0 +1,263 @@
+#include "slab.h"
+#include "stdint.h"
+#include "list.h"
+#include "global.h"
+#include "memory.h"
+#include "string.h"
+#include "debug.h"
+#include "interrupt.h"
+#include "stdio-kernel.h"
+
+#define PG_SIZE 4096
+#define SLAB_FREE_KEEP 1    // 每个缓存最多保留的全空闲 slab 数, 多出的归还内存池
+
+// slab 占一页, 页首为此结构, 其后是对象槽
+struct slab {
+    struct kmem_cache* cache;   // 所属的缓存
+    struct list_elem slab_tag;  // 用于加入缓存的三个 slab 链表之一
+    void* free_obj;             // 本 slab 中空闲对象链表的表头
+    uint32_t inuse;             // 已分配出去的对象数
+};
+
+struct list cache_list;                 // 所有对象缓存
+static struct kmem_cache cache_cache;   // 用来分配 kmem_cache 结构本身的缓存
+
+// 空闲链接字放在对象之后, 这样空闲对象的内容保持构造后的状态
+#define OBJ_LINK(cache, obj) (*(void**)((uint32_t)(obj) + (cache)->obj_size))
+#define ROUND_UP(X, STEP) (DIV_ROUND_UP(X, STEP) * (STEP))
+
+// 初始化缓存 cache 的各项参数
+static void cache_setup(struct kmem_cache* cache, const char* name, \
+                        uint32_t size, uint32_t align, kmem_ctor* ctor) {
+    ASSERT(size > 0 && (align & (align - 1)) == 0);
+    if (align < sizeof(void*)) {
+        align = sizeof(void*);
+    }
+    uint32_t idx = 0;
+    while (idx < CACHE_NAME_LEN - 1 && name[idx]) {
+        cache->name[idx] = name[idx];
+        idx++;
+    }
+    cache->name[idx] = 0;
+
+    cache->obj_size = ROUND_UP(size, align);
+    cache->slot_size = ROUND_UP(cache->obj_size + sizeof(void*), align);
+    cache->obj_offset = ROUND_UP(sizeof(struct slab), align);
+    cache->objs_per_slab = (PG_SIZE - cache->obj_offset) / cache->slot_size;
+    // 一页放不下两个对象时, 对象直接占用整页, 不再划分 slab
+    if (cache->objs_per_slab < 2) {
+        cache->objs_per_slab = 0;
+        cache->pages_per_obj = DIV_ROUND_UP(size, PG_SIZE);
+    } else {
+        cache->pages_per_obj = 0;
+    }
+    cache->ctor = ctor;
+
+    list_init(&cache->slabs_partial);
+    list_init(&cache->slabs_full);
+    list_init(&cache->slabs_free);
+    cache->free_slabs = 0;
+    cache->page_top = 0;
+    cache->active_objs = 0;
+    cache->total_objs = 0;
+    cache->hit = 0;
+    cache->miss = 0;
+}
+
+// 为 cache 申请一页作为新的 slab, 并构造其中所有对象
+// 会申请内核内存池的锁, 不能在关中断的临界区内调用
+static struct slab* slab_grow(struct kmem_cache* cache) {
+    struct slab* slab = get_kernel_pages_af(1, AF_NOZERO);
+    if (slab == NULL) {
+        return NULL;
+    }
+    slab->cache = cache;
+    slab->inuse = 0;
+    slab->free_obj = NULL;
+
+    // 从后往前串起空闲链表, 使对象按地址从低到高分配
+    uint32_t obj_idx = cache->objs_per_slab;
+    while (obj_idx-- > 0) {
+        void* obj = (void*)((uint32_t)slab + cache->obj_offset + obj_idx * cache->slot_size);
+        if (cache->ctor != NULL) {
+            cache->ctor(obj);
+        }
+        OBJ_LINK(cache, obj) = slab->free_obj;
+        slab->free_obj = obj;
+    }
+    return slab;
+}
+
+// 整页对象的分配, 先取缓存的空闲对象, 没有再向内存池申请
+static void* page_obj_alloc(struct kmem_cache* cache) {
+    enum intr_status old_status = intr_disable();
+    if (cache->page_top > 0) {
+        void* obj = cache->page_stack[--cache->page_top];
+        cache->hit++;
+        cache->active_objs++;
+        intr_set_status(old_status);
+        return obj;
+    }
+    intr_set_status(old_status);
+
+    void* obj = get_kernel_pages_af(cache->pages_per_obj, AF_NOZERO);
+    if (obj == NULL) {
+        return NULL;
+    }
+    if (cache->ctor != NULL) {
+        cache->ctor(obj);
+    }
+    old_status = intr_disable();
+    cache->miss++;
+    cache->active_objs++;
+    cache->total_objs++;
+    intr_set_status(old_status);
+    return obj;
+}
+
+// 整页对象的释放, 不向对象写任何内容, 因此可以释放当前线程自己的 pcb
+static void page_obj_free(struct kmem_cache* cache, void* obj) {
+    ASSERT(((uint32_t)obj & (PG_SIZE - 1)) == 0);
+    enum intr_status old_status = intr_disable();
+    cache->active_objs--;
+    if (cache->page_top < SLAB_PAGE_CACHE) {
+        cache->page_stack[cache->page_top++] = obj;
+        intr_set_status(old_status);
+        return;
+    }
+    cache->total_objs--;
+    intr_set_status(old_status);
+    mfree_page(PF_KERNEL, obj, cache->pages_per_obj);
+}
+
+// 从缓存 cache 中分配一个对象, 失败返回 NULL
+// 对象不会被清零, 其内容是构造后或上次释放时的状态
+void* kmem_cache_alloc(struct kmem_cache* cache) {
+    if (cache->objs_per_slab == 0) {
+        return page_obj_alloc(cache);
+    }
+
+    bool grown = false;
+    enum intr_status old_status = intr_disable();
+    while (list_empty(&cache->slabs_partial) && list_empty(&cache->slabs_free)) {
+        intr_set_status(old_status);
+        struct slab* new_slab = slab_grow(cache);
+        if (new_slab == NULL) {
+            return NULL;
+        }
+        old_status = intr_disable();
+        list_append(&cache->slabs_free, &new_slab->slab_tag);
+        cache->free_slabs++;
+        cache->total_objs += cache->objs_per_slab;
+        grown = true;
+    }
+
+    // 优先用部分使用的 slab, 让空闲 slab 有机会被归还
+    struct slab* slab;
+    if (!list_empty(&cache->slabs_partial)) {
+        slab = elem2entry(struct slab, slab_tag, cache->slabs_partial.head.next);
+    } else {
+        slab = elem2entry(struct slab, slab_tag, list_pop(&cache->slabs_free));
+        cache->free_slabs--;
+        list_push(&cache->slabs_partial, &slab->slab_tag);
+    }
+
+    void* obj = slab->free_obj;
+    ASSERT(obj != NULL);
+    slab->free_obj = OBJ_LINK(cache, obj);
+    if (++slab->inuse == cache->objs_per_slab) {
+        list_remove(&slab->slab_tag);
+        list_append(&cache->slabs_full, &slab->slab_tag);
+    }
+    cache->active_objs++;
+    if (grown) {
+        cache->miss++;
+    } else {
+        cache->hit++;
+    }
+    intr_set_status(old_status);
+    return obj;
+}
+
+// 把对象 obj 归还给缓存 cache, 调用者应保证对象处于构造后的状态
+void kmem_cache_free(struct kmem_cache* cache, void* obj) {
+    ASSERT(obj != NULL);
+    if (cache->objs_per_slab == 0) {
+        page_obj_free(cache, obj);
+        return;
+    }
+
+    struct slab* slab = (struct slab*)((uint32_t)obj & 0xfffff000);
+    struct slab* release = NULL;
+    ASSERT(slab->cache == cache && slab->inuse > 0);
+    enum intr_status old_status = intr_disable();
+    OBJ_LINK(cache, obj) = slab->free_obj;
+    slab->free_obj = obj;
+    cache->active_objs--;
+
+    // 满的 slab 有了空闲对象, 移回部分使用链表
+    if (slab->inuse-- == cache->objs_per_slab) {
+        list_remove(&slab->slab_tag);
+        list_push(&cache->slabs_partial, &slab->slab_tag);
+    }
+    // slab 全空闲时, 保留少量备用, 其余归还内存池
+    if (slab->inuse == 0) {
+        list_remove(&slab->slab_tag);
+        if (cache->free_slabs < SLAB_FREE_KEEP) {
+            list_append(&cache->slabs_free, &slab->slab_tag);
+            cache->free_slabs++;
+        } else {
+            cache->total_objs -= cache->objs_per_slab;
+            release = slab;
+        }
+    }
+    intr_set_status(old_status);
+
+    if (release != NULL) {
+        mfree_page(PF_KERNEL, release, 1);
+    }
+}
+
+// 创建名为 name 的对象缓存, 对象大小为 size 字节, 按 align 对齐
+// ctor 非空时, 对象在第一次生成时调用 ctor 构造
+struct kmem_cache* kmem_cache_create(const char* name, uint32_t size, uint32_t align, kmem_ctor* ctor) {
+    struct kmem_cache* cache = kmem_cache_alloc(&cache_cache);
+    if (cache == NULL) {
+        return NULL;
+    }
+    cache_setup(cache, name, size, align, ctor);
+    enum intr_status old_status = intr_disable();
+    list_append(&cache_list, &cache->cache_tag);
+    intr_set_status(old_status);
+    return cache;
+}
+
+// list_traversal 的回调函数, 打印一个对象缓存的统计
+// 先在关中断下取出各项计数, 打印时不关中断
+static bool cache_info_print(struct list_elem* pelem, int arg) {
+    struct kmem_cache* cache = elem2entry(struct kmem_cache, cache_tag, pelem);
+    enum intr_status old_status = intr_disable();
+    uint32_t active = cache->active_objs;
+    uint32_t total = cache->total_objs;
+    uint32_t free_slabs = cache->free_slabs;
+    uint32_t hit = cache->hit;
+    uint32_t miss = cache->miss;
+    intr_set_status(old_status);
+    printk_stdout("%s  %d  %d  %d  %d  %d  %d  %d\n", cache->name, cache->obj_size, \
+                  cache->objs_per_slab, active, total, free_slabs, hit, miss);
+    return false;
+}
+
+// 把所有对象缓存的统计写到标准输出, OBJ/SLAB 为 0 表示整页对象
+// 缓存创建后不会销毁, 因此遍历 cache_list 不用加锁
+void sys_slabinfo(void) {
+    printk_stdout("NAME  OBJSIZE  OBJ/SLAB  ACTIVE  TOTAL  FREESLABS  HIT  MISS\n");
+    list_traversal(&cache_list, cache_info_print, 0);
+}
+
+// 初始化对象缓存, 需在内存池初始化之后调用
+void kmem_cache_init(void) {
+    list_init(&cache_list);
+    cache_setup(&cache_cache, "kmem_cache", sizeof(struct kmem_cache), 0, NULL);
+    list_append(&cache_list, &cache_cache.cache_tag);
+}
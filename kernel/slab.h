@@ -0,0 +1,43 @@
+#ifndef __KERNEL_SLAB_H
+#define __KERNEL_SLAB_H
+#include "stdint.h"
+#include "list.h"
+#include "global.h"
+
+#define CACHE_NAME_LEN 16       // 缓存名的最大长度
+#define SLAB_PAGE_CACHE 8       // 整页对象缓存最多保留的空闲对象数
+
+typedef void kmem_ctor(void*);
+
+// 对象缓存, 管理某一种固定大小的内核对象
+struct kmem_cache {
+    char name[CACHE_NAME_LEN];
+    uint32_t obj_size;          // 对象按 align 对齐后的大小
+    uint32_t slot_size;         // 每个对象槽的大小, 对象之后紧跟空闲链接字
+    uint32_t obj_offset;        // 第一个对象在 slab 页内的偏移
+    uint32_t objs_per_slab;     // 每个 slab 可容纳的对象数, 为 0 表示整页对象
+    uint32_t pages_per_obj;     // 整页对象占用的页数
+    kmem_ctor* ctor;            // 对象构造函数, 只在对象第一次生成时调用
+
+    struct list slabs_partial;  // 部分使用的 slab
+    struct list slabs_full;     // 对象已全部分配的 slab
+    struct list slabs_free;     // 全部空闲的 slab
+    uint32_t free_slabs;        // slabs_free 中的 slab 数
+
+    void* page_stack[SLAB_PAGE_CACHE]; // 整页对象模式下缓存的空闲对象
+    uint32_t page_top;          // page_stack 中的对象数
+
+    uint32_t active_objs;       // 已分配出去的对象数
+    uint32_t total_objs;        // 缓存中已构造的对象总数
+    uint32_t hit;               // 直接由缓存满足的分配次数
+    uint32_t miss;              // 需要向内存池申请新页的分配次数
+    struct list_elem cache_tag; // 用于加入 cache_list
+};
+
+extern struct list cache_list;
+void kmem_cache_init(void);
+struct kmem_cache* kmem_cache_create(const char* name, uint32_t size, uint32_t align, kmem_ctor* ctor);
+void* kmem_cache_alloc(struct kmem_cache* cache);
+void kmem_cache_free(struct kmem_cache* cache, void* obj);
+void sys_slabinfo(void);
+#endif
@@ -0,0 +1,373 @@
+#include "swap.h"
+#include "stdint.h"
+#include "global.h"
+#include "debug.h"
+#include "ide.h"
+#include "list.h"
+#include "memory.h"
+#include "interrupt.h"
+#include "string.h"
+#include "sync.h"
+#include "slab.h"
+#include "lz.h"
+#include "stdio.h"
+#include "stdio-kernel.h"
+
+// 交换分区按页划分为交换槽, 第 slot 个槽占分区中从 slot * SECS_PER_SLOT 起的扇区
+// 槽的引用计数为 0 表示空闲; fork 后父子进程的页表项可能指向同一个槽, 计数随之增加
+// 0 号槽不用, 槽号 0 表示分配失败
+//
+// 换出的页先压缩后放在内存中的压缩存储里, 不必等待硬盘, 槽号不变, 只是内容暂存在内存
+// 压缩存储占用的内存达到上限时, 把最久没有用到的页写回该槽在硬盘上的位置
+// 压缩后超过一半页大小的页不值得放在内存中, 直接写入硬盘
+
+#define PG_SIZE 4096
+#define SECS_PER_SLOT (PG_SIZE / 512)   // 每个交换槽占用的扇区数
+#define SLOT_MAX 0x100000               // 换出项的高 20 位存放槽号
+#define ZRAM_CAP_DEFAULT 512            // 压缩存储默认最多占用的页数
+#define ZCLASS_CNT 7                    // 压缩存储中对象的规格数
+
+// 各规格每页容纳的对象数, 压缩后的页放入能容纳它的最小规格
+static const uint8_t zclass_objs[ZCLASS_CNT] = {64, 32, 16, 8, 4, 3, 2};
+
+// 压缩存储中的一页, 压缩后的数据紧跟在结构之后
+struct zentry {
+    struct list_elem lru_tag;   // 用于加入 zram.lru, 交换槽释放后用于加入 zram.reap
+    uint32_t slot;              // 所在的交换槽
+    uint32_t fill;              // 整页由同一个字填充时的值
+    uint16_t size;              // 压缩后的字节数, 为 0 表示整页由 fill 填充, 不存数据
+    uint8_t cls;                // 对象的规格
+    uint8_t data[];
+};
+
+// 内存中的压缩存储, 除 lock 外的链表和计数都在关中断下修改
+// 换出、换入和写回都持有 lock, 因此写回硬盘期间同一个槽不会被读出
+struct zram {
+    struct lock lock;
+    struct list lru;            // 压缩存储中的页, 表头是最久没有用到的
+    struct list reap;           // 交换槽已释放的页, 持有 lock 时才归还对象缓存
+    uint32_t cap_pages;         // 最多占用的内存页数, 按对象大小计算
+    uint32_t bytes;             // 对象占用的字节数
+    uint32_t pages;             // 存放的页数
+    uint32_t compr_bytes;       // 这些页压缩后的字节数
+    uint32_t same_pages;        // 其中整页由同一个字填充的页数
+    uint32_t rejected;          // 压缩效果太差而直接写入硬盘的页数
+    uint32_t writebacks;        // 因达到上限写回硬盘的页数
+};
+
+static struct partition* swap_part;     // 交换分区, 为 NULL 表示没有交换分区
+static uint16_t* slot_refs;             // 各交换槽的引用计数
+static struct zentry** slot_zram;       // 各交换槽在压缩存储中的页, 为 NULL 表示内容在硬盘上
+static uint32_t slot_cnt;               // 交换槽数, 含不用的 0 号槽
+static uint32_t slots_free;             // 空闲的交换槽数
+static uint32_t slot_cursor;            // 下次从此处开始找空闲槽
+static uint32_t swap_ins;               // 累计换入的页数
+static uint32_t swap_outs;              // 累计换出的页数
+static uint32_t disk_ins;               // 其中从硬盘读入的页数
+static uint32_t disk_outs;              // 其中直接写入硬盘的页数
+
+static struct zram zram;
+static struct kmem_cache* zcaches[ZCLASS_CNT];  // 各规格对象的缓存
+static uint32_t zclass_size[ZCLASS_CNT];        // 各规格对象的字节数
+static uint8_t* zbuf;                           // 压缩结果的缓冲区
+static uint8_t* wbuf;                           // 写回硬盘时解压的缓冲区
+static uint16_t* lz_table;                      // 压缩用的散列表
+
+// list_traversal 的回调函数, 找出分区类型为交换分区的分区
+static bool swap_part_find(struct list_elem* pelem, int arg /*UNUSED*/) {
+    struct partition* part = elem2entry(struct partition, part_tag, pelem);
+    return part->fs_type == PART_TYPE_SWAP && part->sec_cnt >= 2 * SECS_PER_SLOT;
+}
+
+// 是否还有空闲的交换槽可用于换出
+bool swap_available(void) {
+    return slots_free > 0;
+}
+
+// 分配一个空闲的交换槽, 引用计数置为 1, 没有空闲槽时返回 0
+uint32_t swap_slot_alloc(void) {
+    enum intr_status old_status = intr_disable();
+    if (slots_free == 0) {
+        intr_set_status(old_status);
+        return 0;
+    }
+    while (slot_refs[slot_cursor] != 0) {
+        if (++slot_cursor == slot_cnt) {
+            slot_cursor = 1;
+        }
+    }
+    uint32_t slot = slot_cursor;
+    slot_refs[slot] = 1;
+    slots_free--;
+    intr_set_status(old_status);
+    return slot;
+}
+
+// fork 时子进程共享交换槽 slot, 引用计数加 1
+void swap_slot_dup(uint32_t slot) {
+    enum intr_status old_status = intr_disable();
+    ASSERT(slot > 0 && slot < slot_cnt && slot_refs[slot] > 0);
+    slot_refs[slot]++;
+    intr_set_status(old_status);
+}
+
+// 把页 e 从压缩存储中摘下, 需关中断调用
+static void zram_detach(struct zentry* e) {
+    list_remove(&e->lru_tag);
+    slot_zram[e->slot] = NULL;
+    zram.bytes -= zclass_size[e->cls];
+    zram.pages--;
+    zram.compr_bytes -= e->size;
+    if (e->size == 0) {
+        zram.same_pages--;
+    }
+}
+
+// 不再使用交换槽 slot, 引用计数减到 0 时槽变为空闲
+// 可能在关中断或使用临时映射窗口时调用, 压缩存储中的页只挂到 zram.reap, 由 swap_reap 归还
+void swap_slot_put(uint32_t slot) {
+    enum intr_status old_status = intr_disable();
+    ASSERT(slot > 0 && slot < slot_cnt && slot_refs[slot] > 0);
+    if (--slot_refs[slot] == 0) {
+        struct zentry* e = slot_zram[slot];
+        if (e != NULL) {
+            zram_detach(e);
+            list_append(&zram.reap, &e->lru_tag);
+        }
+        slots_free++;
+    }
+    intr_set_status(old_status);
+}
+
+// 归还 zram.reap 中的页, 需持有 zram.lock
+static void zram_reap(void) {
+    while (1) {
+        enum intr_status old_status = intr_disable();
+        if (list_empty(&zram.reap)) {
+            intr_set_status(old_status);
+            return;
+        }
+        struct zentry* e = elem2entry(struct zentry, lru_tag, list_pop(&zram.reap));
+        intr_set_status(old_status);
+        kmem_cache_free(zcaches[e->cls], e);
+    }
+}
+
+// 归还交换槽已释放的压缩页, 在可以阻塞的地方调用
+void swap_reap(void) {
+    if (swap_part == NULL) {
+        return;
+    }
+    lock_acquire(&zram.lock);
+    zram_reap();
+    lock_release(&zram.lock);
+}
+
+// 把压缩存储中的页 e 解压到 page
+static void zram_load(struct zentry* e, void* page) {
+    if (e->size == 0) {
+        uint32_t* word = page;
+        uint32_t idx = 0;
+        while (idx < PG_SIZE / 4) {
+            word[idx++] = e->fill;
+        }
+        return;
+    }
+    if (!lz_decompress(e->data, e->size, page, PG_SIZE)) {
+        PANIC("zram: corrupted page");
+    }
+}
+
+// 把压缩存储中最久没有用到的页写回硬盘, 需持有 zram.lock, 压缩存储为空时返回 false
+// 先摘下再写盘, 写盘期间该槽即使被释放并重新分配, 新内容也要等拿到锁后才能写入
+static bool zram_writeback(void) {
+    enum intr_status old_status = intr_disable();
+    if (list_empty(&zram.lru)) {
+        intr_set_status(old_status);
+        return false;
+    }
+    struct zentry* e = elem2entry(struct zentry, lru_tag, zram.lru.head.next);
+    zram_detach(e);
+    intr_set_status(old_status);
+
+    uint32_t slot = e->slot;
+    zram_load(e, wbuf);
+    kmem_cache_free(zcaches[e->cls], e);
+    ide_write(swap_part->my_disk, swap_part->start_lba + slot * SECS_PER_SLOT, wbuf, SECS_PER_SLOT);
+    zram.writebacks++;
+    return true;
+}
+
+// 尝试把 page 压缩后存入压缩存储, 作为交换槽 slot 的内容, 需持有 zram.lock
+// 压缩效果太差、超过上限或申请不到内存时返回 false, 由调用者写入硬盘
+static bool zram_store(uint32_t slot, void* page) {
+    uint32_t* word = page;
+    uint32_t idx = 1, size = 0;
+    while (idx < PG_SIZE / 4 && word[idx] == word[0]) {
+        idx++;
+    }
+    if (idx < PG_SIZE / 4) {
+        uint32_t max = zclass_size[ZCLASS_CNT - 1] - sizeof(struct zentry);
+        size = lz_compress(page, PG_SIZE, zbuf, max, lz_table);
+        if (size == 0) {
+            zram.rejected++;
+            return false;
+        }
+    }
+    uint8_t cls = 0;
+    while (zclass_size[cls] - sizeof(struct zentry) < size) {
+        cls++;
+    }
+    uint32_t cap = zram.cap_pages * PG_SIZE;
+    if (zclass_size[cls] > cap) {
+        return false;
+    }
+    while (zram.bytes + zclass_size[cls] > cap && zram_writeback()) {
+    }
+
+    struct zentry* e = kmem_cache_alloc(zcaches[cls]);
+    if (e == NULL) {
+        return false;
+    }
+    e->slot = slot;
+    e->fill = word[0];
+    e->size = size;
+    e->cls = cls;
+    memcpy(e->data, zbuf, size);
+
+    enum intr_status old_status = intr_disable();
+    slot_zram[slot] = e;
+    list_append(&zram.lru, &e->lru_tag);
+    zram.bytes += zclass_size[cls];
+    zram.pages++;
+    zram.compr_bytes += size;
+    if (size == 0) {
+        zram.same_pages++;
+    }
+    intr_set_status(old_status);
+    return true;
+}
+
+// 把交换槽 slot 中的页读入 page, 内容在硬盘上时会阻塞
+// 压缩存储中的页仍留着, 其它共享该槽的进程还可能读它, 槽释放时才归还
+void swap_read(uint32_t slot, void* page) {
+    ASSERT(slot > 0 && slot < slot_cnt);
+    lock_acquire(&zram.lock);
+    zram_reap();
+    struct zentry* e = slot_zram[slot];
+    if (e != NULL) {
+        zram_load(e, page);
+        enum intr_status old_status = intr_disable();
+        list_remove(&e->lru_tag);
+        list_append(&zram.lru, &e->lru_tag);
+        intr_set_status(old_status);
+    } else {
+        ide_read(swap_part->my_disk, swap_part->start_lba + slot * SECS_PER_SLOT, page, SECS_PER_SLOT);
+        disk_ins++;
+    }
+    swap_ins++;
+    lock_release(&zram.lock);
+}
+
+// 把 page 中的页写入交换槽 slot, 优先放入压缩存储, 放不下时写入硬盘
+void swap_write(uint32_t slot, void* page) {
+    ASSERT(slot > 0 && slot < slot_cnt && slot_zram[slot] == NULL);
+    lock_acquire(&zram.lock);
+    zram_reap();
+    if (!zram_store(slot, page)) {
+        ide_write(swap_part->my_disk, swap_part->start_lba + slot * SECS_PER_SLOT, page, SECS_PER_SLOT);
+        disk_outs++;
+    }
+    swap_outs++;
+    lock_release(&zram.lock);
+}
+
+// 把压缩存储的上限设为 pages 页, 超出的部分立即写回硬盘, pages 为负数时只查询
+// 返回原来的上限, 没有交换分区时返回 -1
+int32_t sys_zram_cap(int32_t pages) {
+    if (swap_part == NULL) {
+        return -1;
+    }
+    lock_acquire(&zram.lock);
+    int32_t old_cap = zram.cap_pages;
+    if (pages >= 0) {
+        zram.cap_pages = pages;
+        while (zram.bytes > zram.cap_pages * PG_SIZE && zram_writeback()) {
+        }
+        zram_reap();
+    }
+    lock_release(&zram.lock);
+    return old_cap;
+}
+
+// 向标准输出写出交换分区与压缩存储的使用情况, 压缩率为压缩后的字节数占原页大小的百分比
+void swap_info_print(void) {
+    if (swap_part == NULL) {
+        printk_stdout("swap: none\n");
+        return;
+    }
+    printk_stdout("swap: %s  %d/%d slots used  %d pages in (%d from disk)  %d pages out (%d to disk)\n", \
+                  swap_part->name, slot_cnt - 1 - slots_free, slot_cnt - 1, swap_ins, disk_ins, swap_outs, disk_outs);
+    enum intr_status old_status = intr_disable();
+    uint32_t pages = zram.pages, bytes = zram.bytes, compr_bytes = zram.compr_bytes;
+    intr_set_status(old_status);
+    printk_stdout("zram: %d pages in %d bytes, compressed to %d%%, cap %d pages\n", pages, bytes, \
+                  pages == 0 ? 0 : compr_bytes * 100 / (pages * PG_SIZE), zram.cap_pages);
+    printk_stdout("  %d same-filled  %d incompressible  %d written back\n", \
+                  zram.same_pages, zram.rejected, zram.writebacks);
+}
+
+// 创建压缩存储的对象缓存和缓冲区, 失败返回 false
+static bool zram_init(void) {
+    char name[CACHE_NAME_LEN];
+    uint8_t cls;
+    for (cls = 0; cls < ZCLASS_CNT; cls++) {
+        // 留出 slab 头和空闲链接字, 使每页恰好容纳 zclass_objs[cls] 个对象
+        zclass_size[cls] = ((PG_SIZE - 64) / zclass_objs[cls] - 8) & ~3;
+        sprintf(name, "zram-%d", zclass_size[cls]);
+        zcaches[cls] = kmem_cache_create(name, zclass_size[cls], 0, NULL);
+        if (zcaches[cls] == NULL) {
+            return false;
+        }
+    }
+    zbuf = get_kernel_pages(1);
+    wbuf = get_kernel_pages(1);
+    lz_table = get_kernel_pages(DIV_ROUND_UP(LZ_TABLE_SIZE, PG_SIZE));
+    if (zbuf == NULL || wbuf == NULL || lz_table == NULL) {
+        return false;
+    }
+    lock_init(&zram.lock);
+    list_init(&zram.lru);
+    list_init(&zram.reap);
+    zram.cap_pages = ZRAM_CAP_DEFAULT;
+    return true;
+}
+
+// 找出第一个交换分区并建立交换槽的引用计数和压缩存储, 再启动换出线程, 需在 ide_init 之后调用
+// 没有交换分区时用户页不会被换出
+void swap_init(void) {
+    struct list_elem* elem = list_traversal(&partition_list, swap_part_find, 0);
+    if (elem == NULL) {
+        printk("swap_init: no swap partition\n");
+        return;
+    }
+    struct partition* part = elem2entry(struct partition, part_tag, elem);
+    uint32_t cnt = part->sec_cnt / SECS_PER_SLOT;
+    if (cnt > SLOT_MAX) {
+        cnt = SLOT_MAX;
+    }
+    slot_refs = sys_malloc(cnt * sizeof(uint16_t));
+    slot_zram = sys_malloc(cnt * sizeof(struct zentry*));
+    if (slot_refs == NULL || slot_zram == NULL || !zram_init()) {
+        printk("swap_init: alloc memory failed\n");
+        return;
+    }
+    memset(slot_refs, 0, cnt * sizeof(uint16_t));
+    memset(slot_zram, 0, cnt * sizeof(struct zentry*));
+    swap_part = part;
+    slot_cnt = cnt;
+    slots_free = cnt - 1;
+    slot_cursor = 1;
+    printk("swap_init: %s, %d slots, zram cap %d pages\n", part->name, slots_free, zram.cap_pages);
+    swapper_start();
+}
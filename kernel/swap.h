@@ -0,0 +1,15 @@
+#ifndef __KERNEL_SWAP_H
+#define __KERNEL_SWAP_H
+#include "stdint.h"
+#include "global.h"
+void swap_init(void);
+bool swap_available(void);
+uint32_t swap_slot_alloc(void);
+void swap_slot_dup(uint32_t slot);
+void swap_slot_put(uint32_t slot);
+void swap_read(uint32_t slot, void* page);
+void swap_write(uint32_t slot, void* page);
+void swap_reap(void);
+int32_t sys_zram_cap(int32_t pages);
+void swap_info_print(void);
+#endif
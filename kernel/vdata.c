@@ -0,0 +1,26 @@
+#include "vdata.h"
+#include "stdint.h"
+#include "global.h"
+#include "memory.h"
+#include "string.h"
+#include "print.h"
+#include "debug.h"
+
+// 共享数据页分配之前, 各模块先写入 vdata_boot, vdata_init 时整体搬进共享数据页
+static struct vdata vdata_boot;
+struct vdata* vdata = &vdata_boot;     // 内核经此写共享数据页, 这个映射可写
+
+// 分配共享数据页并以只读、用户可访问的属性映射到 VDATA_VADDR, 需在 timer_init 之后调用
+// 内核空间的页表为所有进程共享, 映射一次即对所有进程生效; cr0 的 WP 位已开启, 内核只能经 vdata 写入
+void vdata_init(void) {
+    put_str("vdata_init start\n");
+    struct vdata* page = get_kernel_pages(1);
+    if (page == NULL) {
+        PANIC("vdata_init: alloc page failed");
+    }
+    memcpy(page, &vdata_boot, sizeof(struct vdata));
+    *pte_ptr(VDATA_VADDR) = addr_v2p((uint32_t)page) | PG_G | PG_US_U | PG_RW_R | PG_P_1;
+    asm volatile ("invlpg %0" : : "m" (*(char*)VDATA_VADDR) : "memory");
+    vdata = page;
+    put_str("vdata_init done\n");
+}
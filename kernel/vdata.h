@@ -0,0 +1,50 @@
+#ifndef __KERNEL_VDATA_H
+#define __KERNEL_VDATA_H
+#include "stdint.h"
+#include "global.h"
+#include "io.h"
+
+#define VDATA_VADDR 0xffbff000      // 共享数据页在所有进程中的固定地址, 位于内核最后一个页表中
+#define VDATA_TSC_SHIFT 24          // 由 TSC 周期数换算纳秒时的定点位数
+#define VDATA ((const struct vdata*)VDATA_VADDR)    // 用户程序经此读取共享数据页
+
+// 内核与所有进程共享的数据页, 用户态只读, 读取其中的字段不必陷入内核
+// 各字段都是单个字或开机后不再改变, 单处理器上直接读取即可得到一致的值
+struct vdata {
+    int16_t pid;                // 当前任务的 pid, 切换任务时更新
+    uint32_t ticks;             // 开机以来的嘀嗒数
+    uint64_t tsc_base;          // 单调时钟零点的 TSC
+    uint32_t tsc_mult;          // 每个 TSC 周期的纳秒数乘以 2^VDATA_TSC_SHIFT, 为 0 表示只能按嘀嗒计时
+    uint32_t ns_per_tick;       // 每个嘀嗒的纳秒数
+    uint32_t switches;          // 开机以来的任务切换次数
+    uint32_t nr_ready;          // 就绪队列中的任务数
+    uint32_t sysenter;          // 为 1 表示处理器支持并已设置好 sysenter, 系统调用可不经 int 0x80
+};
+
+extern struct vdata* vdata;
+
+// 64 位数 n 除以 32 位数 d, 余数存入 *rem, 避免依赖 libgcc 的 64 位除法
+static inline uint64_t div64(uint64_t n, uint32_t d, uint32_t* rem) {
+    uint32_t hi = n >> 32, lo = (uint32_t)n;
+    uint32_t q_hi = hi / d, r = hi % d, q_lo;
+    // 余数小于除数, divl 的商不会溢出
+    asm ("divl %4" : "=a" (q_lo), "=d" (r) : "a" (lo), "d" (r), "rm" (d));
+    if (rem != NULL) {
+        *rem = r;
+    }
+    return ((uint64_t)q_hi << 32) | q_lo;
+}
+
+// 按 vd 中的时钟参数计算开机以来的单调时间, 单位为纳秒, 内核与用户程序共用
+// ns = cycles * tsc_mult >> VDATA_TSC_SHIFT, 拆成高低两个 32 位的乘法
+static inline uint64_t vdata_clock_ns(const struct vdata* vd) {
+    if (vd->tsc_mult == 0) {
+        return (uint64_t)vd->ticks * vd->ns_per_tick;
+    }
+    uint64_t cycles = rdtsc() - vd->tsc_base;
+    uint32_t hi = cycles >> 32, lo = (uint32_t)cycles;
+    return (((uint64_t)hi * vd->tsc_mult) << (32 - VDATA_TSC_SHIFT)) + (((uint64_t)lo * vd->tsc_mult) >> VDATA_TSC_SHIFT);
+}
+
+void vdata_init(void);
+#endif
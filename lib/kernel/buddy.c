@@ -0,0 +1,248 @@
+#include "buddy.h"
+#include "stdint.h"
+#include "list.h"
+#include "global.h"
+#include "debug.h"
+#include "interrupt.h"
+
+// 把以 idx 为首页的 2^order 页作为空闲块挂到 free_area 上, 不做合并
+static void free_area_add(struct buddy* b, uint32_t idx, uint8_t order) {
+    struct buddy_node* node = &b->nodes[idx];
+    node->free = 1;
+    node->order = order;
+    list_append(&b->free_area[order], &node->free_elem);
+}
+
+// 初始化伙伴系统, nodes 为 node_cnt 个页节点, 初始时所有页均已占用
+// 由调用者用 buddy_free_pages 释放其中实际可用的页, 用于管理有空洞的物理内存
+void buddy_init_used(struct buddy* b, struct buddy_node* nodes, uint32_t node_cnt) {
+    uint32_t idx = 0;
+    uint8_t order = 0;
+    b->nodes = nodes;
+    b->node_cnt = node_cnt;
+    b->free_pages = 0;
+    while (order <= BUDDY_MAX_ORDER) {
+        list_init(&b->free_area[order]);
+        order++;
+    }
+    while (idx < node_cnt) {
+        nodes[idx].free = 0;
+        nodes[idx].order = 0;
+        nodes[idx].ref = 0;
+        nodes[idx].owner = 0;
+        idx++;
+    }
+}
+
+// 初始化伙伴系统, nodes 为 node_cnt 个页节点, 初始时所有页均空闲
+void buddy_init(struct buddy* b, struct buddy_node* nodes, uint32_t node_cnt) {
+    buddy_init_used(b, nodes, node_cnt);
+    buddy_free_pages(b, 0, node_cnt);
+}
+
+// 分配 2^order 个连续页, 成功返回首页下标, 失败返回 -1
+int32_t buddy_alloc(struct buddy* b, uint8_t order) {
+    ASSERT(order <= BUDDY_MAX_ORDER);
+    enum intr_status old_status = intr_disable();
+
+    // 从 order 阶开始往上找第一个非空的空闲链表
+    uint8_t cur_order = order;
+    while (cur_order <= BUDDY_MAX_ORDER && list_empty(&b->free_area[cur_order])) {
+        cur_order++;
+    }
+    if (cur_order > BUDDY_MAX_ORDER) {
+        intr_set_status(old_status);
+        return -1;
+    }
+
+    struct buddy_node* node = elem2entry(struct buddy_node, free_elem, list_pop(&b->free_area[cur_order]));
+    uint32_t idx = node - b->nodes;
+    node->free = 0;
+
+    // 大块逐级对半拆分, 后一半挂回低一阶的空闲链表
+    while (cur_order > order) {
+        cur_order--;
+        free_area_add(b, idx + (1 << cur_order), cur_order);
+    }
+    b->free_pages -= (1 << order);
+    intr_set_status(old_status);
+    return idx;
+}
+
+// 释放以 idx 为首页的 2^order 个页, 并与空闲的伙伴逐级合并
+void buddy_free(struct buddy* b, uint32_t idx, uint8_t order) {
+    ASSERT(idx < b->node_cnt && !b->nodes[idx].free);
+    enum intr_status old_status = intr_disable();
+    b->free_pages += (1 << order);
+
+    while (order < BUDDY_MAX_ORDER) {
+        uint32_t buddy_idx = idx ^ (1 << order);
+        // 伙伴块必须完整地落在管理范围内
+        if (buddy_idx + (1 << order) > b->node_cnt) {
+            break;
+        }
+        struct buddy_node* buddy = &b->nodes[buddy_idx];
+        // 伙伴不空闲或阶不同, 停止合并
+        if (!buddy->free || buddy->order != order) {
+            break;
+        }
+        list_remove(&buddy->free_elem);
+        buddy->free = 0;
+        if (buddy_idx < idx) {
+            idx = buddy_idx;
+        }
+        order++;
+    }
+    free_area_add(b, idx, order);
+    intr_set_status(old_status);
+}
+
+// 在最大阶的空闲链表中找 blk_cnt 个首尾相接的空闲块, 一起摘下, 成功返回首页下标, 失败返回 -1
+// 最大阶的块不再合并, 大段的空闲页在链表中就是一串相邻的最大阶块
+static int32_t buddy_alloc_run(struct buddy* b, uint32_t blk_cnt) {
+    const uint32_t blk_pages = 1U << BUDDY_MAX_ORDER;
+    struct list* area = &b->free_area[BUDDY_MAX_ORDER];
+    enum intr_status old_status = intr_disable();
+
+    struct list_elem* elem = area->head.next;
+    while (elem != &area->tail) {
+        uint32_t idx = elem2entry(struct buddy_node, free_elem, elem) - b->nodes;
+        uint32_t n = 1;
+        while (n < blk_cnt && idx + (n + 1) * blk_pages <= b->node_cnt && \
+               b->nodes[idx + n * blk_pages].free && b->nodes[idx + n * blk_pages].order == BUDDY_MAX_ORDER) {
+            n++;
+        }
+        if (n == blk_cnt) {
+            for (n = 0; n < blk_cnt; n++) {
+                struct buddy_node* node = &b->nodes[idx + n * blk_pages];
+                list_remove(&node->free_elem);
+                node->free = 0;
+            }
+            b->free_pages -= blk_cnt * blk_pages;
+            intr_set_status(old_status);
+            return idx;
+        }
+        elem = elem->next;
+    }
+    intr_set_status(old_status);
+    return -1;
+}
+
+// 分配恰好 cnt 个连续页, 多出的尾部归还给伙伴系统
+// 超过 2^BUDDY_MAX_ORDER 页时改为拼接相邻的最大阶块
+int32_t buddy_alloc_pages(struct buddy* b, uint32_t cnt) {
+    ASSERT(cnt > 0);
+    uint8_t order = 0;
+    int32_t idx;
+    const uint32_t blk_pages = 1U << BUDDY_MAX_ORDER;
+    if (cnt > blk_pages) {
+        uint32_t blk_cnt = DIV_ROUND_UP(cnt, blk_pages);
+        idx = buddy_alloc_run(b, blk_cnt);
+        if (idx != -1 && blk_cnt * blk_pages > cnt) {
+            buddy_free_pages(b, idx + cnt, blk_cnt * blk_pages - cnt);
+        }
+        return idx;
+    }
+    while ((1U << order) < cnt) {
+        order++;
+    }
+    idx = buddy_alloc(b, order);
+    if (idx == -1) {
+        return -1;
+    }
+    if ((1U << order) > cnt) {
+        buddy_free_pages(b, idx + cnt, (1 << order) - cnt);
+    }
+    return idx;
+}
+
+// 释放从 idx 开始的 cnt 个页, 拆成若干对齐的块逐个释放
+void buddy_free_pages(struct buddy* b, uint32_t idx, uint32_t cnt) {
+    while (cnt > 0) {
+        uint8_t order = 0;
+        // 找出 idx 处对齐且不超过 cnt 的最大块
+        while (order < BUDDY_MAX_ORDER && \
+               (idx & ((1 << (order + 1)) - 1)) == 0 && \
+               (1U << (order + 1)) <= cnt) {
+            order++;
+        }
+        buddy_free(b, idx, order);
+        idx += (1 << order);
+        cnt -= (1 << order);
+    }
+}
+
+// 返回 buddy_alloc_pages 一次能分配的最多连续页数, 没有空闲页时返回 0
+// 最大阶的块不再合并, 相邻的一串最大阶块按整串计算
+uint32_t buddy_max_free_run(struct buddy* b) {
+    const uint32_t blk_pages = 1U << BUDDY_MAX_ORDER;
+    struct list* area = &b->free_area[BUDDY_MAX_ORDER];
+    int32_t order = BUDDY_MAX_ORDER;
+    while (order >= 0 && list_empty(&b->free_area[order])) {
+        order--;
+    }
+    if (order < BUDDY_MAX_ORDER) {
+        return order == -1 ? 0 : 1U << order;
+    }
+
+    uint32_t max_run = 0;
+    enum intr_status old_status = intr_disable();
+    struct list_elem* elem = area->head.next;
+    while (elem != &area->tail) {
+        uint32_t idx = elem2entry(struct buddy_node, free_elem, elem) - b->nodes;
+        // 只从一串的第一块开始数, 前面紧挨着空闲的最大阶块时跳过
+        if (idx < blk_pages || !b->nodes[idx - blk_pages].free || \
+            b->nodes[idx - blk_pages].order != BUDDY_MAX_ORDER) {
+            uint32_t n = 1;
+            while (idx + (n + 1) * blk_pages <= b->node_cnt && \
+                   b->nodes[idx + n * blk_pages].free && b->nodes[idx + n * blk_pages].order == BUDDY_MAX_ORDER) {
+                n++;
+            }
+            if (n * blk_pages > max_run) {
+                max_run = n * blk_pages;
+            }
+        }
+        elem = elem->next;
+    }
+    intr_set_status(old_status);
+    return max_run;
+}
+
+// 把指定的第 idx 页从空闲块中摘出来标记为已用, 成功返回 true, 该页已被占用则返回 false
+int buddy_claim(struct buddy* b, uint32_t idx) {
+    ASSERT(idx < b->node_cnt);
+    enum intr_status old_status = intr_disable();
+
+    // 找到包含 idx 的空闲块
+    uint8_t order = 0;
+    uint32_t head = idx;
+    while (order <= BUDDY_MAX_ORDER) {
+        head = idx & ~((1 << order) - 1);
+        if (b->nodes[head].free && b->nodes[head].order == order) {
+            break;
+        }
+        order++;
+    }
+    if (order > BUDDY_MAX_ORDER) {
+        intr_set_status(old_status);
+        return false;
+    }
+
+    list_remove(&b->nodes[head].free_elem);
+    b->nodes[head].free = 0;
+
+    // 逐级拆分, 不包含 idx 的一半挂回空闲链表
+    while (order > 0) {
+        order--;
+        uint32_t half = 1 << order;
+        if (idx < head + half) {
+            free_area_add(b, head + half, order);
+        } else {
+            free_area_add(b, head, order);
+            head += half;
+        }
+    }
+    b->free_pages--;
+    intr_set_status(old_status);
+    return true;
+}
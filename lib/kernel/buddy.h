@@ -0,0 +1,33 @@
+#ifndef __LIB_KERNEL_BUDDY_H
+#define __LIB_KERNEL_BUDDY_H
+#include "stdint.h"
+#include "list.h"
+
+#define BUDDY_MAX_ORDER 11     // 最大的块为 2^11 页, 即 8MB
+
+// 伙伴系统中每页对应的节点, 只有空闲块的首页才挂在 free_area 上
+struct buddy_node {
+    struct list_elem free_elem; // 用于加入 free_area[order] 链表
+    uint8_t order;              // 空闲块的阶, 块大小为 2^order 页
+    uint8_t free;               // 为 1 表示此页是某个空闲块的首页
+    uint16_t ref;               // 页的引用计数, 伙伴系统不使用, 由内存池维护
+    uint8_t owner;              // 最近一次使用此页的内存池, 伙伴系统不使用, 释放后仍保留
+};
+
+// 伙伴系统, 管理 node_cnt 个连续的页
+struct buddy {
+    struct buddy_node* nodes;                    // 每页一个节点, 下标即页号
+    uint32_t node_cnt;                           // 管理的页数
+    uint32_t free_pages;                         // 当前空闲的页数
+    struct list free_area[BUDDY_MAX_ORDER + 1];  // 各阶空闲块链表
+};
+
+void buddy_init(struct buddy* b, struct buddy_node* nodes, uint32_t node_cnt);
+void buddy_init_used(struct buddy* b, struct buddy_node* nodes, uint32_t node_cnt);
+int32_t buddy_alloc(struct buddy* b, uint8_t order);
+void buddy_free(struct buddy* b, uint32_t idx, uint8_t order);
+int32_t buddy_alloc_pages(struct buddy* b, uint32_t cnt);
+void buddy_free_pages(struct buddy* b, uint32_t idx, uint32_t cnt);
+int buddy_claim(struct buddy* b, uint32_t idx);
+uint32_t buddy_max_free_run(struct buddy* b);
+#endif
@@ -60,4 +60,16 @@ static inline void insw(uint16_t port, void* addr, uint32_t word_cnt){
 	// 					rep insw
 }
 
+/* 读取处理器的时间戳计数器, 每个时钟周期加 1 */
+static inline uint64_t rdtsc(void) {
+	uint32_t low, high;
+	asm volatile ("rdtsc" : "=a" (low), "=d" (high));
+	return ((uint64_t)high << 32) | low;
+}
+
+/* 把 value 写入编号为 msr 的模型特定寄存器 */
+static inline void wrmsr(uint32_t msr, uint64_t value) {
+	asm volatile ("wrmsr" : : "c" (msr), "a" ((uint32_t)value), "d" ((uint32_t)(value >> 32)));
+}
+
 #endif
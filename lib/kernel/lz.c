@@ -0,0 +1,149 @@
+#include "lz.h"
+#include "stdint.h"
+#include "global.h"
+#include "string.h"
+
+// LZ77 一族的简单压缩算法, 格式仿照 LZ4 的块格式, 只用于不超过 64KB 的数据
+// 压缩结果由若干序列组成, 每个序列为:
+//   标记字节: 高 4 位为字面量长度, 低 4 位为匹配长度减 LZ_MIN_MATCH, 取 15 时后跟扩展字节
+//   [字面量长度扩展] 字面量 [2 字节小端的匹配距离 [匹配长度扩展]]
+// 扩展字节依次累加, 直到某个字节不是 255; 最后一个序列只有字面量, 输入到此结束
+// 压缩时用散列表记录每个 4 字节串最近出现的位置, 只找一个候选, 速度优先
+
+#define LZ_MIN_MATCH 4      // 最短的匹配长度
+#define LZ_MAX_DIST 0xffff  // 最远的匹配距离
+
+static uint32_t read32(const uint8_t* p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint32_t lz_hash(uint32_t v) {
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+// 在 dst 的 *op 处写入长度 len 超出 15 的部分, 空间不足返回 false
+static bool put_len(uint8_t* dst, uint32_t* op, uint32_t cap, uint32_t len) {
+    while (len >= 255) {
+        if (*op >= cap) {
+            return false;
+        }
+        dst[(*op)++] = 255;
+        len -= 255;
+    }
+    if (*op >= cap) {
+        return false;
+    }
+    dst[(*op)++] = len;
+    return true;
+}
+
+// 写入一个序列: src 中 lit_len 个字面量, 之后匹配 match_len 个字节, match_len 为 0 表示最后一个序列
+static bool put_seq(uint8_t* dst, uint32_t* op, uint32_t cap, const uint8_t* lit, uint32_t lit_len, \
+                    uint32_t dist, uint32_t match_len) {
+    uint32_t ml = match_len == 0 ? 0 : match_len - LZ_MIN_MATCH;
+    if (*op >= cap) {
+        return false;
+    }
+    dst[(*op)++] = ((lit_len < 15 ? lit_len : 15) << 4) | (ml < 15 ? ml : 15);
+    if (lit_len >= 15 && !put_len(dst, op, cap, lit_len - 15)) {
+        return false;
+    }
+    if (cap - *op < lit_len) {
+        return false;
+    }
+    memcpy(dst + *op, lit, lit_len);
+    *op += lit_len;
+    if (match_len == 0) {
+        return true;
+    }
+    if (cap - *op < 2) {
+        return false;
+    }
+    dst[(*op)++] = dist & 0xff;
+    dst[(*op)++] = dist >> 8;
+    return ml < 15 || put_len(dst, op, cap, ml - 15);
+}
+
+// 把 src 中的 len 个字节压缩到 dst, dst 最多写 cap 个字节
+// table 为调用者提供的 LZ_TABLE_SIZE 字节工作区, 返回压缩后的字节数, 放不下时返回 0
+uint32_t lz_compress(const uint8_t* src, uint32_t len, uint8_t* dst, uint32_t cap, uint16_t* table) {
+    uint32_t ip = 0, anchor = 0, op = 0;
+    memset(table, 0, LZ_TABLE_SIZE);
+    while (ip + LZ_MIN_MATCH <= len) {
+        uint32_t v = read32(src + ip);
+        uint32_t h = lz_hash(v);
+        uint32_t ref = table[h];
+        table[h] = ip;
+        if (ref >= ip || ip - ref > LZ_MAX_DIST || read32(src + ref) != v) {
+            ip++;
+            continue;
+        }
+        uint32_t match_len = LZ_MIN_MATCH;
+        while (ip + match_len < len && src[ref + match_len] == src[ip + match_len]) {
+            match_len++;
+        }
+        if (!put_seq(dst, &op, cap, src + anchor, ip - anchor, ip - ref, match_len)) {
+            return 0;
+        }
+        ip += match_len;
+        anchor = ip;
+    }
+    if (!put_seq(dst, &op, cap, src + anchor, len - anchor, 0, 0)) {
+        return 0;
+    }
+    return op;
+}
+
+// 读出 src 中 *ip 处的长度扩展字节累加到 *n, 越界返回 false
+static bool get_len(const uint8_t* src, uint32_t len, uint32_t* ip, uint32_t* n) {
+    uint8_t b;
+    do {
+        if (*ip >= len) {
+            return false;
+        }
+        b = src[(*ip)++];
+        *n += b;
+    } while (b == 255);
+    return true;
+}
+
+// 把 lz_compress 的结果 src (len 字节) 解压到 dst, 解压后须恰好为 dst_len 字节, 数据损坏时返回 false
+bool lz_decompress(const uint8_t* src, uint32_t len, uint8_t* dst, uint32_t dst_len) {
+    uint32_t ip = 0, op = 0;
+    while (ip < len) {
+        uint8_t token = src[ip++];
+        uint32_t lit_len = token >> 4;
+        if (lit_len == 15 && !get_len(src, len, &ip, &lit_len)) {
+            return false;
+        }
+        if (len - ip < lit_len || dst_len - op < lit_len) {
+            return false;
+        }
+        memcpy(dst + op, src + ip, lit_len);
+        ip += lit_len;
+        op += lit_len;
+        if (ip == len) {
+            break;  // 最后一个序列
+        }
+
+        if (len - ip < 2) {
+            return false;
+        }
+        uint32_t dist = src[ip] | (src[ip + 1] << 8);
+        ip += 2;
+        uint32_t match_len = token & 0xf;
+        if (match_len == 15 && !get_len(src, len, &ip, &match_len)) {
+            return false;
+        }
+        match_len += LZ_MIN_MATCH;
+        if (dist == 0 || dist > op || dst_len - op < match_len) {
+            return false;
+        }
+        // 匹配可能与正在写的部分重叠, 只能逐字节复制
+        while (match_len-- > 0) {
+            dst[op] = dst[op - dist];
+            op++;
+        }
+    }
+    return op == dst_len;
+}
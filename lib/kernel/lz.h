@@ -0,0 +1,11 @@
+#ifndef __LIB_KERNEL_LZ_H
+#define __LIB_KERNEL_LZ_H
+#include "stdint.h"
+#include "global.h"
+
+#define LZ_HASH_BITS 12                     // 压缩时散列表的位数
+#define LZ_TABLE_SIZE ((1 << LZ_HASH_BITS) * sizeof(uint16_t))  // 压缩所需工作区的字节数
+
+uint32_t lz_compress(const uint8_t* src, uint32_t len, uint8_t* dst, uint32_t cap, uint16_t* table);
+bool lz_decompress(const uint8_t* src, uint32_t len, uint8_t* dst, uint32_t dst_len);
+#endif
@@ -3,6 +3,9 @@
 #include "stdio.h"
 #include "console.h"
 #include "global.h"
+#include "fs.h"
+#include "file.h"
+#include "string.h"
 
 #define va_start(args, first_fix) args = (va_list)&first_fix
 #define va_end(args) args = NULL
@@ -15,4 +18,15 @@ void printk(const char* format, ...) {
     vsprintf(buf, format, args);
     va_end(args);
     console_put_str(buf);
-}
\ No newline at end of file
+}
+
+// 供系统调用使用的格式化输出函数, 写到当前任务的标准输出, 可随标准输出重定向到文件或管道
+// 可能因写文件或管道而阻塞, 调用时不能持有内存池等锁
+void printk_stdout(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    char buf[1024] = {0};
+    vsprintf(buf, format, args);
+    va_end(args);
+    sys_write(stdout_no, buf, strlen(buf));
+}
@@ -2,4 +2,5 @@
 #define __LIB_KERNEL_STDIOSYS_H
 #include "stdint.h"
 void printk(const char* format, ...);
+void printk_stdout(const char* format, ...);
 #endif
\ No newline at end of file
@@ -0,0 +1,246 @@
+#include "malloc.h"
+#include "stdint.h"
+#include "syscall.h"
+#include "assert.h"
+
+// 用户态堆分配器, 堆内存通过 sbrk 按页向内核申请
+// 小块按规格从空闲链表分配, 不需要陷入内核; 只有堆顶积累了大段空闲页时才归还内核
+
+#define PG_SIZE 4096
+#define CLASS_CNT 7             // 16 ~ 1024 字节共 7 种规格
+#define CHUNK_MAGIC 0x4d414c43  // 页头的校验值
+#define HEAP_GROW_PAGES 16      // 每次至少向内核申请的页数, 减少 sbrk 的次数
+#define HEAP_TRIM_PAGES 64      // 堆顶的空闲页段达到此页数才归还内核
+#define CLASS_EMPTY_KEEP 1      // 每种规格最多保留的全空闲页数, 多出的并回空闲页段
+
+// 空闲的小块, 串在所属规格的空闲链表中
+struct block {
+   struct block* prev;
+   struct block* next;
+};
+
+// 每次分出的页段的首部, 小块页与大块内存共用
+struct chunk {
+   uint32_t magic;
+   uint32_t pages;      // 页段的页数
+   uint32_t cls;        // 小块的规格下标, 大块内存为 CLASS_CNT
+   uint32_t free_cnt;   // 小块页中空闲块的数量
+};
+
+// 空闲页段, 此结构放在段的首页, 各段按地址升序串成链表
+struct run {
+   struct run* next;
+   uint32_t pages;
+};
+
+static struct block* class_free[CLASS_CNT];  // 各规格的空闲块链表
+static uint32_t class_empty[CLASS_CNT];      // 各规格全空闲的页数
+static struct run* free_runs;                // 空闲页段链表
+static uint32_t heap_end;                    // 已向内核申请的堆末端, 为 0 表示尚未申请过
+
+// 规格 cls 的块大小
+static uint32_t class_size(uint32_t cls) {
+   return 16 << cls;
+}
+
+// 一页中能容纳的规格 cls 的块数
+static uint32_t class_blocks(uint32_t cls) {
+   return (PG_SIZE - sizeof(struct chunk)) / class_size(cls);
+}
+
+// 块 b 所在页的页头
+static struct chunk* block2chunk(void* b) {
+   return (struct chunk*)((uint32_t)b & 0xfffff000);
+}
+
+// 把从 addr 开始的 pages 页并入空闲页段链表, 并与前后相邻的段合并, 返回合并后的段
+static struct run* run_insert(uint32_t addr, uint32_t pages) {
+   struct run* prev = NULL;
+   struct run* next = free_runs;
+   while (next != NULL && (uint32_t)next < addr) {
+      prev = next;
+      next = next->next;
+   }
+
+   struct run* r = (struct run*)addr;
+   r->pages = pages;
+   r->next = next;
+   if (next != NULL && addr + pages * PG_SIZE == (uint32_t)next) {
+      r->pages += next->pages;
+      r->next = next->next;
+   }
+   if (prev != NULL && (uint32_t)prev + prev->pages * PG_SIZE == addr) {
+      prev->pages += r->pages;
+      prev->next = r->next;
+      r = prev;
+   } else if (prev != NULL) {
+      prev->next = r;
+   } else {
+      free_runs = r;
+   }
+   return r;
+}
+
+// 空闲页段 r 位于堆顶且足够大时, 留下一部分备用, 其余归还内核
+static void heap_trim(struct run* r) {
+   if ((uint32_t)r + r->pages * PG_SIZE == heap_end && r->pages >= HEAP_TRIM_PAGES) {
+      uint32_t trim = (r->pages - HEAP_GROW_PAGES) * PG_SIZE;
+      if (sbrk(-(int32_t)trim) != (void*)-1) {
+         heap_end -= trim;
+         r->pages = HEAP_GROW_PAGES;
+      }
+   }
+}
+
+// 向内核申请至少 pages 页扩展堆, 新页并入空闲页段链表
+static bool heap_grow(uint32_t pages) {
+   if (pages < HEAP_GROW_PAGES) {
+      pages = HEAP_GROW_PAGES;
+   }
+   void* old_brk = sbrk(pages * PG_SIZE);
+   if (old_brk == (void*)-1) {
+      return false;
+   }
+   // 堆起始地址页对齐, 且堆只由本分配器调整, 因此 old_brk 总是页对齐的
+   assert(((uint32_t)old_brk & (PG_SIZE - 1)) == 0);
+   heap_end = (uint32_t)old_brk + pages * PG_SIZE;
+   run_insert((uint32_t)old_brk, pages);
+   return true;
+}
+
+// 分配 pages 个连续页, 首次适配, 从段尾切出以免改动链表
+static struct chunk* run_take(uint32_t pages) {
+   while (1) {
+      struct run* prev = NULL;
+      struct run* r = free_runs;
+      while (r != NULL && r->pages < pages) {
+         prev = r;
+         r = r->next;
+      }
+      if (r != NULL) {
+         if (r->pages > pages) {
+            r->pages -= pages;
+            return (struct chunk*)((uint32_t)r + r->pages * PG_SIZE);
+         }
+         if (prev != NULL) {
+            prev->next = r->next;
+         } else {
+            free_runs = r->next;
+         }
+         return (struct chunk*)r;
+      }
+      if (!heap_grow(pages)) {
+         return NULL;
+      }
+   }
+}
+
+// 把块 b 挂到规格 cls 的空闲链表头
+static void block_push(uint32_t cls, struct block* b) {
+   b->prev = NULL;
+   b->next = class_free[cls];
+   if (b->next != NULL) {
+      b->next->prev = b;
+   }
+   class_free[cls] = b;
+}
+
+// 把块 b 从规格 cls 的空闲链表中摘除
+static void block_unlink(uint32_t cls, struct block* b) {
+   if (b->prev != NULL) {
+      b->prev->next = b->next;
+   } else {
+      class_free[cls] = b->next;
+   }
+   if (b->next != NULL) {
+      b->next->prev = b->prev;
+   }
+}
+
+// 为规格 cls 切分一个新页, 所有块挂入空闲链表
+static bool class_grow(uint32_t cls) {
+   struct chunk* c = run_take(1);
+   if (c == NULL) {
+      return false;
+   }
+   c->magic = CHUNK_MAGIC;
+   c->pages = 1;
+   c->cls = cls;
+   c->free_cnt = class_blocks(cls);
+   uint32_t idx = c->free_cnt;
+   while (idx-- > 0) {
+      block_push(cls, (struct block*)((uint32_t)(c + 1) + idx * class_size(cls)));
+   }
+   class_empty[cls]++;
+   return true;
+}
+
+// 申请 size 字节的内存, 失败返回 NULL, 内容不保证为 0
+void* malloc(uint32_t size) {
+   if (size == 0) {
+      return NULL;
+   }
+
+   // 超过 1024 字节直接分配整页
+   if (size > class_size(CLASS_CNT - 1)) {
+      uint32_t pages = (size + sizeof(struct chunk) + PG_SIZE - 1) / PG_SIZE;
+      struct chunk* c = run_take(pages);
+      if (c == NULL) {
+         return NULL;
+      }
+      c->magic = CHUNK_MAGIC;
+      c->pages = pages;
+      c->cls = CLASS_CNT;
+      c->free_cnt = 0;
+      return c + 1;
+   }
+
+   uint32_t cls = 0;
+   while (class_size(cls) < size) {
+      cls++;
+   }
+   if (class_free[cls] == NULL && !class_grow(cls)) {
+      return NULL;
+   }
+   struct block* b = class_free[cls];
+   block_unlink(cls, b);
+   struct chunk* c = block2chunk(b);
+   if (c->free_cnt-- == class_blocks(cls)) {
+      class_empty[cls]--;
+   }
+   return b;
+}
+
+// 释放 ptr 指向的内存, ptr 为 NULL 时什么也不做
+void free(void* ptr) {
+   if (ptr == NULL) {
+      return;
+   }
+   struct chunk* c = block2chunk(ptr);
+   assert(c->magic == CHUNK_MAGIC);
+
+   if (c->cls == CLASS_CNT) {
+      c->magic = 0;
+      heap_trim(run_insert((uint32_t)c, c->pages));
+      return;
+   }
+
+   uint32_t cls = c->cls;
+   uint32_t blocks = class_blocks(cls);
+   block_push(cls, ptr);
+   if (++c->free_cnt < blocks) {
+      return;
+   }
+   // 整页空闲, 保留少量备用, 其余从链表中摘下所有块后并回空闲页段
+   if (class_empty[cls] < CLASS_EMPTY_KEEP) {
+      class_empty[cls]++;
+      return;
+   }
+   uint32_t idx = 0;
+   while (idx < blocks) {
+      block_unlink(cls, (struct block*)((uint32_t)(c + 1) + idx * class_size(cls)));
+      idx++;
+   }
+   c->magic = 0;
+   heap_trim(run_insert((uint32_t)c, 1));
+}
@@ -0,0 +1,6 @@
+#ifndef __LIB_USER_MALLOC_H
+#define __LIB_USER_MALLOC_H
+#include "stdint.h"
+void* malloc(uint32_t size);
+void free(void* ptr);
+#endif
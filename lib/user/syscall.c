@@ -1,57 +1,63 @@
 #include "syscall.h"
 
-/* 无参数的系统调用 */
-#define _syscall0(NUMBER) ({	           \
-   int retval;					           \
-   asm volatile (					       \
-   "int $0x80"						       \
-   : "=a" (retval)					       \
-   : "a" (NUMBER)					       \
-   : "memory"						       \
-   );							           \
-   retval;						           \
-})
-
-/* 一个参数的系统调用 */
-#define _syscall1(NUMBER, ARG1) ({			       \
-   int retval;					               \
+/* 经 int 0x80 进入内核, 最多三个参数, 所有处理器都支持 */
+#define _int80(NUMBER, ARG1, ARG2, ARG3) ({		       \
+   int retval;						       \
    asm volatile (					       \
-   "int $0x80"						       \
-   : "=a" (retval)					       \
-   : "a" (NUMBER), "b" (ARG1)				       \
-   : "memory"						       \
+      "int $0x80"					       \
+      : "=a" (retval)					       \
+      : "a" (NUMBER), "b" (ARG1), "c" (ARG2), "d" (ARG3)       \
+      : "memory"					       \
    );							       \
    retval;						       \
 })
 
-/* 两个参数的系统调用 */
-#define _syscall2(NUMBER, ARG1, ARG2) ({		       \
+/* 经 sysenter 进入内核, 返回地址和用户栈指针分别经 esi 和 edi 交给内核
+ * sysexit 用 ecx 和 edx 带回这两个值, 因此这两个寄存器的内容会被改写 */
+#define _sysenter(NUMBER, ARG1, ARG2, ARG3) ({		       \
    int retval;						       \
+   uint32_t ecx = (uint32_t)(ARG2), edx = (uint32_t)(ARG3);    \
    asm volatile (					       \
-   "int $0x80"						       \
-   : "=a" (retval)					       \
-   : "a" (NUMBER), "b" (ARG1), "c" (ARG2)		       \
-   : "memory"						       \
+      "movl %%esp, %%edi\n\t"				       \
+      "movl $1f, %%esi\n\t"				       \
+      "sysenter\n"					       \
+      "1:"						       \
+      : "=a" (retval), "+c" (ecx), "+d" (edx)		       \
+      : "a" (NUMBER), "b" (ARG1)				       \
+      : "esi", "edi", "memory"				       \
    );							       \
    retval;						       \
 })
 
+/* 处理器支持时走 sysenter, 否则退回 int 0x80 */
+#define _syscall(NUMBER, ARG1, ARG2, ARG3)		       \
+   (VDATA->sysenter ? _sysenter(NUMBER, ARG1, ARG2, ARG3) : _int80(NUMBER, ARG1, ARG2, ARG3))
+
+/* 无参数的系统调用 */
+#define _syscall0(NUMBER) _syscall(NUMBER, 0, 0, 0)
+
+/* 一个参数的系统调用 */
+#define _syscall1(NUMBER, ARG1) _syscall(NUMBER, ARG1, 0, 0)
+
+/* 两个参数的系统调用 */
+#define _syscall2(NUMBER, ARG1, ARG2) _syscall(NUMBER, ARG1, ARG2, 0)
+
 /* 三个参数的系统调用 */
-#define _syscall3(NUMBER, ARG1, ARG2, ARG3) ({		       \
-   int retval;						       \
-   asm volatile (					       \
-      "int $0x80"					       \
-      : "=a" (retval)					       \
-      : "a" (NUMBER), "b" (ARG1), "c" (ARG2), "d" (ARG3)       \
-      : "memory"					       \
-   );							       \
-   retval;						       \
-})
+#define _syscall3(NUMBER, ARG1, ARG2, ARG3) _syscall(NUMBER, ARG1, ARG2, ARG3)
+
+// 强制经 int 0x80 发起无参数的系统调用 nr, 用于比较两种入口的开销
+int32_t syscall_int80(uint32_t nr) {
+   return _int80(nr, 0, 0, 0);
+}
 
+// 强制经 sysenter 发起无参数的系统调用 nr, 调用者须先确认 VDATA->sysenter 为 1
+int32_t syscall_sysenter(uint32_t nr) {
+   return _sysenter(nr, 0, 0, 0);
+}
 
-// 返回当前任务pid 
+// 返回当前任务pid, 直接读共享数据页, 不陷入内核
 uint32_t getpid() {
-   return _syscall0(SYS_GETPID);
+   return VDATA->pid;
 }
 
 /* 打印字符串str */
@@ -59,16 +65,6 @@ uint32_t write(int32_t fd, const void* buf, uint32_t count) {
    return _syscall3(SYS_WRITE, fd, buf, count);
 }
 
-// 申请 size 字节大小的内存, 并返回结果
-void* malloc(uint32_t size) {
-   return (void*)_syscall1(SYS_MALLOC, size);
-}
-
-// 释放 ptr 指向的内存
-void free(void* ptr) {
-   _syscall1(SYS_FREE, ptr);
-}
-
 /* 派生子进程,返回子进程pid */
 pid_t fork(void){
    return _syscall0(SYS_FORK);
@@ -188,3 +184,72 @@ void fd_redirect(uint32_t old_local_fd, uint32_t new_local_fd) {
 void help(void) {
    _syscall0(SYS_HELP);
 }
+
+// 把堆末端设为 addr, 返回新的堆末端, 失败时返回原来的堆末端, addr 为 NULL 时只查询
+void* brk(void* addr) {
+   return (void*)_syscall1(SYS_BRK, addr);
+}
+
+// 把堆末端移动 increment 字节, 返回原来的堆末端, 失败返回 (void*)-1
+void* sbrk(int32_t increment) {
+   uint32_t old_brk = (uint32_t)brk(NULL);
+   if (increment == 0) {
+      return (void*)old_brk;
+   }
+   uint32_t new_brk = old_brk + increment;
+   if ((uint32_t)brk((void*)new_brk) != new_brk) {
+      return (void*)-1;
+   }
+   return (void*)old_brk;
+}
+
+/* 显示内存池及内存块的使用情况 */
+void meminfo(void) {
+   _syscall0(SYS_MEMINFO);
+}
+
+/* 显示内核对象缓存的使用情况 */
+void slabinfo(void) {
+   _syscall0(SYS_SLABINFO);
+}
+
+/* 测试上下文切换的开销 */
+void cswbench(void) {
+   _syscall0(SYS_CSWBENCH);
+}
+
+/* 设置压缩交换存储的上限为 pages 页, pages 为负数时只查询, 返回原来的上限 */
+int32_t zram_cap(int32_t pages) {
+   return _syscall1(SYS_ZRAMCAP, pages);
+}
+
+/* 睡眠 req 指定的时间, 成功返回 0 */
+int32_t nanosleep(const struct timespec* req, struct timespec* rem) {
+   return _syscall2(SYS_NANOSLEEP, req, rem);
+}
+
+/* 显示时钟中断的统计 */
+void timerstat(void) {
+   _syscall0(SYS_TIMERSTAT);
+}
+
+/* 读取 clock_id 指定的时钟, 成功返回 0; 按共享数据页中的参数换算 TSC, 不陷入内核 */
+int32_t clock_gettime(int32_t clock_id, struct timespec* tp) {
+   if (clock_id != CLOCK_MONOTONIC || tp == NULL) {
+      return -1;
+   }
+   uint32_t nsec;
+   tp->tv_sec = (int32_t)div64(vdata_clock_ns(VDATA), 1000000000, &nsec);
+   tp->tv_nsec = nsec;
+   return 0;
+}
+
+/* 登记提交/完成环ring, ring为NULL时注销 */
+int32_t uring_setup(struct uring* ring, uint32_t flags) {
+   return _syscall2(SYS_URING_SETUP, ring, flags);
+}
+
+/* 提交至多to_submit个操作, 并等待至少min_complete个完成项 */
+int32_t uring_enter(uint32_t to_submit, uint32_t min_complete) {
+   return _syscall2(SYS_URING_ENTER, to_submit, min_complete);
+}
@@ -3,6 +3,9 @@
 #include "stdint.h"
 #include "fs.h"
 #include "thread.h"
+#include "timer.h"
+#include "vdata.h"
+#include "uring.h"
 enum SYSCALL_NR {   // 用来存放子功能号
    SYS_GETPID,
    SYS_WRITE,
@@ -31,12 +34,21 @@ enum SYSCALL_NR {   // 用来存放子功能号
    SYS_WAIT,
    SYS_PIPE,
    SYS_FD_REDIRECT,
-   SYS_HELP
+   SYS_HELP,
+   SYS_BRK,
+   SYS_MEMINFO,
+   SYS_SLABINFO,
+   SYS_CSWBENCH,
+   SYS_ZRAMCAP,
+   SYS_NANOSLEEP,
+   SYS_TIMERSTAT,
+   SYS_CLOCK_GETTIME,
+   SYS_URING_SETUP,
+   SYS_URING_ENTER,
+   SYS_CNT          // 子功能号的个数, 新的子功能号须加在它之前
 };
 uint32_t getpid(void);
 uint32_t write(int32_t fd, const void* buf, uint32_t count);
-void* malloc(uint32_t size);
-void free(void* ptr);
 int32_t read(int32_t fd, void* buf, uint32_t count);
 void putchar(char char_asci);
 void clear(void);
@@ -60,4 +72,17 @@ pid_t wait(int32_t* status);
 int32_t pipe(int32_t pipefd[2]);
 void fd_redirect(uint32_t old_local_fd, uint32_t new_local_fd);
 void help(void);
+void* brk(void* addr);
+void* sbrk(int32_t increment);
+void meminfo(void);
+void slabinfo(void);
+void cswbench(void);
+int32_t zram_cap(int32_t pages);
+int32_t nanosleep(const struct timespec* req, struct timespec* rem);
+void timerstat(void);
+int32_t clock_gettime(int32_t clock_id, struct timespec* tp);
+int32_t uring_setup(struct uring* ring, uint32_t flags);
+int32_t uring_enter(uint32_t to_submit, uint32_t min_complete);
+int32_t syscall_int80(uint32_t nr);
+int32_t syscall_sysenter(uint32_t nr);
 #endif
\ No newline at end of file
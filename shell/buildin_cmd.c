@@ -202,6 +202,106 @@ void buildin_ps(uint32_t argc, char** argv) {
     ps();
 }
 
+// meminfo 命令内建函数
+void buildin_meminfo(uint32_t argc, char** argv) {
+    if (argc != 1) {
+        printf("meminfo: no argument support!\n");
+        return;
+    }
+    meminfo();
+}
+
+// slabinfo 命令内建函数
+void buildin_slabinfo(uint32_t argc, char** argv) {
+    if (argc != 1) {
+        printf("slabinfo: no argument support!\n");
+        return;
+    }
+    slabinfo();
+}
+
+// cswbench 命令内建函数
+void buildin_cswbench(uint32_t argc, char** argv) {
+    if (argc != 1) {
+        printf("cswbench: no argument support!\n");
+        return;
+    }
+    cswbench();
+}
+
+// timerstat 命令内建函数
+void buildin_timerstat(uint32_t argc, char** argv) {
+    if (argc != 1) {
+        printf("timerstat: no argument support!\n");
+        return;
+    }
+    timerstat();
+}
+
+#define SYSBENCH_ROUNDS 10000     // sysbench 每种入口发起的系统调用次数
+
+// 用 syscall 经某种入口连续发起 SYSBENCH_ROUNDS 次 getpid, 打印平均每次的周期数和纳秒数
+static void sysbench_run(const char* name, int32_t (*syscall)(uint32_t)) {
+    syscall(SYS_GETPID);    // 先预热一次, 免得首次调用的缺页和缓存缺失计入结果
+    uint64_t ns = vdata_clock_ns(VDATA);
+    uint64_t tsc = rdtsc();
+    uint32_t i;
+    for (i = 0; i < SYSBENCH_ROUNDS; i++) {
+        syscall(SYS_GETPID);
+    }
+    tsc = rdtsc() - tsc;
+    ns = vdata_clock_ns(VDATA) - ns;
+    printf("%s  %d        %d\n", name, (uint32_t)div64(tsc, SYSBENCH_ROUNDS, NULL), \
+           (uint32_t)div64(ns, SYSBENCH_ROUNDS, NULL));
+}
+
+// sysbench 命令内建函数, 比较 int 0x80 与 sysenter 两种系统调用入口的往返开销
+void buildin_sysbench(uint32_t argc, char** argv) {
+    if (argc != 1) {
+        printf("sysbench: no argument support!\n");
+        return;
+    }
+    printf("ENTRY     CYCLES/CALL  NS/CALL\n");
+    sysbench_run("int 0x80", syscall_int80);
+    if (VDATA->sysenter) {
+        sysbench_run("sysenter", syscall_sysenter);
+    } else {
+        printf("sysenter  not supported\n");
+    }
+}
+
+// zram 命令内建函数, 无参数时显示压缩交换存储的上限, 有参数时把上限设为该页数
+void buildin_zram(uint32_t argc, char** argv) {
+    if (argc > 2) {
+        printf("zram: only support 1 argument!\n");
+        return;
+    }
+    if (argc == 1) {
+        int32_t cap = zram_cap(-1);
+        if (cap < 0) {
+            printf("zram: no swap partition\n");
+        } else {
+            printf("zram cap: %d pages\n", cap);
+        }
+        return;
+    }
+    int32_t pages = 0;
+    char* p = argv[1];
+    while (*p >= '0' && *p <= '9' && pages < 0x100000) {
+        pages = pages * 10 + (*p++ - '0');
+    }
+    if (*p != 0 || p == argv[1]) {
+        printf("zram: invalid page count %s\n", argv[1]);
+        return;
+    }
+    int32_t old_cap = zram_cap(pages);
+    if (old_cap < 0) {
+        printf("zram: no swap partition\n");
+    } else {
+        printf("zram cap: %d -> %d pages\n", old_cap, pages);
+    }
+}
+
 /* clear命令内建函数 */
 void buildin_clear(uint32_t argc, char** argv /*UNUSED*/) {
    if (argc != 1) {
@@ -16,14 +16,15 @@ int32_t sys_pipe(int32_t pipefd[2]) {
     int32_t global_fd = get_free_slot_in_global();
 
     // 申请一页内核内存做环形环形缓冲区
-    file_table[global_fd].fd_inode = get_kernel_pages(1);
-
-    // 初始化环形缓冲区
-    ioqueue_init((struct ioqueue*)file_table[global_fd].fd_inode);
+    // ioqueue_init 会初始化用到的全部字段, 不必清零
+    file_table[global_fd].fd_inode = get_kernel_pages_af(1, AF_NOZERO);
     if (file_table[global_fd].fd_inode == NULL) {
         return -1;
     }
 
+    // 初始化环形缓冲区
+    ioqueue_init((struct ioqueue*)file_table[global_fd].fd_inode);
+
     // 将 fd_flag 复用为管道标志
     file_table[global_fd].fd_flag = PIPE_FLAG;
 
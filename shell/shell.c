@@ -128,6 +128,18 @@ static void cmd_execute(uint32_t argc, char** argv) {
        buildin_pwd(argc, argv);
     } else if (!strcmp("ps", argv[0])) {
        buildin_ps(argc, argv);
+    } else if (!strcmp("meminfo", argv[0])) {
+       buildin_meminfo(argc, argv);
+    } else if (!strcmp("slabinfo", argv[0])) {
+       buildin_slabinfo(argc, argv);
+    } else if (!strcmp("cswbench", argv[0])) {
+       buildin_cswbench(argc, argv);
+    } else if (!strcmp("zram", argv[0])) {
+       buildin_zram(argc, argv);
+    } else if (!strcmp("timerstat", argv[0])) {
+       buildin_timerstat(argc, argv);
+    } else if (!strcmp("sysbench", argv[0])) {
+       buildin_sysbench(argc, argv);
     } else if (!strcmp("clear", argv[0])) {
        buildin_clear(argc, argv);
     } else if (!strcmp("mkdir", argv[0])){
@@ -3,6 +3,7 @@
 #include "global.h"
 #include "debug.h"
 #include "interrupt.h"
+#include "timer.h"
 
 // 初始化信号量
 void sema_init(struct semaphore* psema, uint8_t value) {
@@ -36,6 +37,44 @@ void sema_down(struct semaphore* psema) {
     intr_set_status(old_status);
 }
 
+// sema_down_timeout 的等待者, 定时器到期时用来找出并唤醒它
+struct sema_waiter {
+    struct semaphore* psema;
+    struct task_struct* thread;
+    bool expired;   // 是否因超时被唤醒
+};
+
+// 等待超时, 若等待者还在信号量的等待队列中, 将其摘下并唤醒
+static void sema_expire(void* arg) {
+    struct sema_waiter* waiter = arg;
+    if (elem_find(&waiter->psema->waiters, &waiter->thread->general_tag)) {
+        list_remove(&waiter->thread->general_tag);
+        waiter->expired = true;
+        thread_unblock(waiter->thread);
+    }
+}
+
+// 带超时的信号量 down 操作, 最多等待 timeout 个嘀嗒, 超时返回 false 且不减少信号量
+bool sema_down_timeout(struct semaphore* psema, uint32_t timeout) {
+    enum intr_status old_status = intr_disable();
+    struct sema_waiter waiter = {psema, running_thread(), false};
+    struct ktimer timer;
+    ktimer_init(&timer, sema_expire, &waiter);
+    ktimer_add(&timer, timeout);
+    while (psema->value == 0 && !waiter.expired) {
+        ASSERT(!elem_find(&psema->waiters, &waiter.thread->general_tag));
+        list_append(&psema->waiters, &waiter.thread->general_tag);
+        thread_block(TASK_BLOCKED);
+    }
+    ktimer_cancel(&timer);
+    bool acquired = psema->value > 0;
+    if (acquired) {
+        psema->value--;
+    }
+    intr_set_status(old_status);
+    return acquired;
+}
+
 // 信号量 up 操作
 void sema_up(struct semaphore* psema) {
     // 关中断保证原子操作
@@ -12,16 +12,136 @@
 #include "fs.h"
 #include "file.h"
 #include "stdio.h"
+#include "slab.h"
+#include "io.h"
+#include "stdio-kernel.h"
+#include "timer.h"
+#include "vdata.h"
 
 struct task_struct* main_thread; // 主线程 PCB
 struct task_struct* idle_thread;        // idle 线程
-struct list thread_ready_list; // 就绪队列
 struct list thread_all_list; // 所有任务队列
 struct lock pid_lock;                   // 分配 pid 锁
-static struct list_elem* thread_tag; // 用于保存队列中的线程结点
+struct kmem_cache* task_cache;          // pcb 所在页的对象缓存
 
 extern void switch_to(struct task_struct* cur, struct task_struct* next);
 
+// 多级反馈队列: 每级一个就绪队列, ready_levels 的第 i 位表示第 i 级队列非空, 挑选下一个任务只需一条 bsf
+// 用完时间片的任务降一级, 级别越低时间片越长; 时间片用掉不到一半就阻塞的任务升一级
+// 更高级别有任务就绪时立即抢占, 每隔 MLFQ_BOOST_TICKS 把所有任务提回最高级别, 低级别的任务不会饿死
+#define MLFQ_BOOST_TICKS 100    // 定期提升的间隔嘀嗒数
+
+static struct list ready_queues[MLFQ_LEVELS];  // 各级就绪队列
+static uint32_t ready_levels;                   // 非空就绪队列的位图
+static uint32_t boost_countdown = MLFQ_BOOST_TICKS; // 距下次定期提升的嘀嗒数
+static const uint8_t mlfq_slice[MLFQ_LEVELS] = {2, 4, 6, 8, 12, 16, 24, 32}; // 各级的时间片
+
+// 当前任务为 cur 时, 调度器最多可以隔多少个嘀嗒才需要时钟中断, 需关中断调用
+// 有别的任务就绪时每个嘀嗒都要检查抢占和轮转; 只剩 cur 时只需在它的时间片用完或定期提升时处理
+uint32_t thread_tick_budget(struct task_struct* cur) {
+    if (ready_levels != 0) {
+        return 1;
+    }
+    if (cur == idle_thread || cur->status != TASK_RUNNING) {
+        return 0xffffffff;
+    }
+    uint32_t budget = cur->ticks + 1;
+    return budget < boost_countdown ? budget : boost_countdown;
+}
+
+// 按优先级换算最高级别, 默认优先级 31 为 0 级, 优先级越低起点越低
+static uint8_t prio_level(uint8_t prio) {
+    uint8_t level = prio >= 31 ? 0 : (31 - prio) / 3;
+    return level < MLFQ_LEVELS ? level : MLFQ_LEVELS - 1;
+}
+
+// 把 pthread 加入所在级别的就绪队列, front 为 true 时放在队首, 需关中断调用
+static void ready_enqueue(struct task_struct* pthread, bool front) {
+    struct list* queue = &ready_queues[pthread->level];
+    ASSERT(!elem_find(queue, &pthread->general_tag));
+    if (front) {
+        list_push(queue, &pthread->general_tag);
+    } else {
+        list_append(queue, &pthread->general_tag);
+    }
+    ready_levels |= 1 << pthread->level;
+    vdata->nr_ready++;
+    // 有任务等着运行, 需要节拍来抢占和轮转; idle 只在没有别的任务时入队, 不必恢复
+    if (pthread != idle_thread) {
+        timer_periodic();
+    }
+}
+
+// 把就绪的 pthread 从所在级别的队列中摘下, 需关中断调用
+static void ready_remove(struct task_struct* pthread) {
+    list_remove(&pthread->general_tag);
+    if (list_empty(&ready_queues[pthread->level])) {
+        ready_levels &= ~(1 << pthread->level);
+    }
+    vdata->nr_ready--;
+}
+
+// 取出最高级别就绪队列的队首任务, 需关中断调用且至少有一个任务就绪
+static struct task_struct* ready_pick(void) {
+    uint32_t level;
+    asm ("bsf %1, %0" : "=r" (level) : "rm" (ready_levels));
+    struct list* queue = &ready_queues[level];
+    struct task_struct* next = elem2entry(struct task_struct, general_tag, list_pop(queue));
+    if (list_empty(queue)) {
+        ready_levels &= ~(1 << level);
+    }
+    vdata->nr_ready--;
+    return next;
+}
+
+// 把新建的任务加入就绪队列末尾, 时间片按所在级别充满, 需关中断调用
+void thread_ready_append(struct task_struct* pthread) {
+    pthread->ticks = mlfq_slice[pthread->level];
+    ready_enqueue(pthread, false);
+}
+
+// list_traversal 的回调函数, 把任务提回最高级别, 就绪的任务换到对应的队列
+static bool task_boost(struct list_elem* pelem, int arg /*UNUSED*/) {
+    struct task_struct* pthread = elem2entry(struct task_struct, all_list_tag, pelem);
+    if (pthread->level != pthread->top_level) {
+        bool ready = pthread->status == TASK_READY;
+        if (ready) {
+            ready_remove(pthread);
+        }
+        pthread->level = pthread->top_level;
+        pthread->ticks = mlfq_slice[pthread->level];
+        if (ready) {
+            ready_enqueue(pthread, false);
+        }
+    }
+    return false;
+}
+
+// 时钟中断中调用, cur 为当前任务, elapsed 为距上次中断经过的嘀嗒数, 无节拍时可能大于 1
+// 负责时间片记账、降级、定期提升和抢占, 需要换任务时直接调度
+void thread_tick(struct task_struct* cur, uint32_t elapsed) {
+    if (boost_countdown <= elapsed) {
+        boost_countdown = MLFQ_BOOST_TICKS;
+        list_traversal(&thread_all_list, task_boost, 0);
+    } else {
+        boost_countdown -= elapsed;
+    }
+    if (cur->ticks < elapsed) {
+        // 用完时间片的多半是计算密集型任务, 降一级, 换成更长但更难轮到的时间片
+        if (cur->level < MLFQ_LEVELS - 1) {
+            cur->level++;
+        }
+        cur->ticks = mlfq_slice[cur->level];
+        schedule();
+        return;
+    }
+    cur->ticks -= elapsed;
+    // 更高级别有任务就绪, 抢占当前任务, 它保留剩余的时间片排到本级队尾
+    if (ready_levels & ((1 << cur->level) - 1)) {
+        schedule();
+    }
+}
+
 // pid 的位图，最大支持 1024 个 pid
 uint8_t pid_bitmap_bits[128] = {0};
 
@@ -62,7 +182,12 @@ void release_pid(pid_t pid) {
 static void idle(void* arg /*UNUSED*/) {
     while (1) {
         thread_block(TASK_BLOCKED);
-        // 执行 hlt 时必须要保证目前处在开中断的情况下
+        // 趁空闲在后台把空闲页清零, 以后申请清零内存时可省去 memset
+        zero_pages_fill();
+        // 没有任务可运行, 下一个时钟中断推迟到最近的定时器到期时
+        intr_disable();
+        timer_oneshot(thread_tick_budget(idle_thread));
+        // 执行 hlt 时必须要保证目前处在开中断的情况下, sti 之后的 hlt 执行前不会响应中断
         asm volatile ("sti; hlt" : : : "memory");
     }
 }
@@ -119,7 +244,8 @@ void init_thread(struct task_struct* pthread, char* name, int prio) {
     // self_kstack 是线程自己在内核态下使用的栈顶地址
     pthread->self_kstack = (uint32_t*)((uint32_t)pthread + PG_SIZE);
     pthread->priority = prio;
-    pthread->ticks = prio;
+    pthread->level = pthread->top_level = prio_level(prio);
+    pthread->ticks = mlfq_slice[pthread->level];
     pthread->elapsed_ticks = 0;
     pthread->pgdir = NULL;
 
@@ -134,6 +260,9 @@ void init_thread(struct task_struct* pthread, char* name, int prio) {
         fd_idx++;
     }
     pthread->cwd_inode_nr = 0;
+    pthread->uring = NULL;
+    pthread->host = NULL;
+    pthread->io_cancel = false;
     pthread->parent_pid = -1;
     pthread->stack_magic = 0x19870916; // 自定义魔数
 }
@@ -145,19 +274,19 @@ struct task_struct* thread_start(char* name,            //线程名
                                  void* func_arg)        //函数的参数
 {
     // PCB 都位于内核空间, 包括用户进程的 PCB 也是在内核空间
-    struct task_struct* thread = get_kernel_pages(1);   //申请一页内核空间存放PCB
+    struct task_struct* thread = kmem_cache_alloc(task_cache);   //申请一页内核空间存放PCB
 
     init_thread(thread, name, prio);                    //初始化线程
     thread_create(thread, function, func_arg);          //创建线程
 
-    // 确保之前不在队列中
-    ASSERT(!elem_find(&thread_ready_list, &thread->general_tag));
+    enum intr_status old_status = intr_disable();
     // 加入就绪线程队列
-    list_append(&thread_ready_list, &thread->general_tag);
+    thread_ready_append(thread);
     // 确保之前不在队列中
     ASSERT(!elem_find(&thread_all_list, &thread->all_list_tag));
     // 加入全部线程队列
     list_append(&thread_all_list, &thread->all_list_tag);
+    intr_set_status(old_status);
 
     return thread;
 }
@@ -177,25 +306,23 @@ void schedule(void) {
 
     struct task_struct* cur = running_thread();
     if(cur->status == TASK_RUNNING) {
-        // 若此线程只是 CPU 时间片到了, 将其加入到就绪队尾
-        ASSERT(!elem_find(&thread_ready_list, &cur->general_tag));
-        list_append(&thread_ready_list, &cur->general_tag);
-        cur->ticks = cur->priority;
+        // 若此线程是时间片到了或被抢占, 将其加入到所在级别的就绪队尾, 时间片由 thread_tick 处理
+        ready_enqueue(cur, false);
         cur->status = TASK_READY;
     } else {
         // 若此线程阻塞, 不需要将其加入队列
     }
 
     // 如果就绪队列中没有可运行的任务, 就唤醒 idle
-    if (list_empty(&thread_ready_list)) {
+    if (ready_levels == 0) {
         thread_unblock(idle_thread);
     }
 
-    ASSERT(!list_empty(&thread_ready_list));
-    thread_tag = NULL;
-    thread_tag = list_pop(&thread_ready_list);
-    struct task_struct* next = elem2entry(struct task_struct, general_tag, thread_tag);
+    struct task_struct* next = ready_pick();
     next->status = TASK_RUNNING;
+    // 共享数据页中的 pid 总是当前任务的, 用户程序读到的就是自己的 pid
+    vdata->pid = next->pid;
+    vdata->switches++;
 
     process_activate(next);
     //while(1);
@@ -206,8 +333,7 @@ void schedule(void) {
 void thread_yield(void) {
     struct task_struct* cur = running_thread();
     enum intr_status old_status = intr_disable();
-    ASSERT(!elem_find(&thread_ready_list, &cur->general_tag));
-    list_append(&thread_ready_list, &cur->general_tag);
+    ready_enqueue(cur, false);
     cur->status = TASK_READY;
     schedule();
     intr_set_status(old_status);
@@ -215,15 +341,21 @@ void thread_yield(void) {
 
 // 回收 thread_over 的 pcb 和页表, 并将其从调度队列中去除
 void thread_exit(struct task_struct* thread_over, bool need_schedule) {
+    // 内核线程弹匣中的内存块归还内核内存池, 要申请锁, 需在标记为 TASK_DIED 之前完成
+    if (thread_over->pgdir == NULL) {
+        magazine_drain(thread_over->mags);
+    }
+
     // 要保证 schedule 在关中断情况下调用
     intr_disable();
     thread_over->status = TASK_DIED;
 
     // 如果 thread_over 不是当前线程, 就有可能还在就绪队列中, 将其从中删除
-    if (elem_find(&thread_ready_list, &thread_over->general_tag)) {
-        list_remove(&thread_over->general_tag);
+    if (elem_find(&ready_queues[thread_over->level], &thread_over->general_tag)) {
+        ready_remove(thread_over);
     }
     if (thread_over->pgdir) { // 如果是进程, 回收进程的页表
+        page_dir_drop(thread_over);
         mfree_page(PF_KERNEL, thread_over->pgdir, 1);
     }
 
@@ -232,7 +364,7 @@ void thread_exit(struct task_struct* thread_over, bool need_schedule) {
 
     // 回收 pcb 所在的页, 主线程的 pcb 不在堆中, 跨过
     if (thread_over != main_thread) {
-        mfree_page(PF_KERNEL, thread_over, 1);
+        kmem_cache_free(task_cache, thread_over);
     }
     
     // 归还 pid
@@ -265,9 +397,14 @@ struct task_struct* pid2thread(int32_t pid) {
 void thread_init(void) {
     put_str("thread_init start\n");
 
-    list_init(&thread_ready_list);
+    uint8_t level;
+    for (level = 0; level < MLFQ_LEVELS; level++) {
+        list_init(&ready_queues[level]);
+    }
     list_init(&thread_all_list);
     pid_pool_init();
+    // pcb 独占一页, 由 task_cache 缓存回收的 pcb 页
+    task_cache = kmem_cache_create("task_struct", PG_SIZE, PG_SIZE, NULL);
 
     // 先创建第一个用户进程 init
     process_execute(init, "init"); // init 进程的 pid 是 1
@@ -290,6 +427,12 @@ void thread_block(enum task_status stat) {
     enum intr_status old_status = intr_disable();
     struct task_struct* cur_thread = running_thread();
     cur_thread->status = stat;
+    // 时间片用掉不到一半就阻塞的多半是交互式任务, 升一级并充满时间片, 醒来后能尽快得到调度
+    // 用掉一半以上的保留剩余时间片, 以免靠频繁阻塞骗取高级别
+    if (cur_thread->ticks * 2 >= mlfq_slice[cur_thread->level] && cur_thread->level > cur_thread->top_level) {
+        cur_thread->level--;
+        cur_thread->ticks = mlfq_slice[cur_thread->level];
+    }
     schedule(); // 将当前线程换下处理器
     intr_set_status(old_status);
 }
@@ -300,9 +443,8 @@ void thread_unblock(struct task_struct* pthread) {
     ASSERT(pthread->status == TASK_BLOCKED || 
            pthread->status == TASK_WAITING || 
            pthread->status == TASK_HANGING);
-    ASSERT(!elem_find(&thread_ready_list, &pthread->general_tag));
-    // 放在就绪队列最前面, 使其尽快得到调度
-    list_push(&thread_ready_list, &pthread->general_tag);
+    // 放在所在级别就绪队列的最前面, 使其尽快得到调度
+    ready_enqueue(pthread, true);
     pthread->status = TASK_READY;
     intr_set_status(old_status);
 }
@@ -364,6 +506,8 @@ static bool elem2thread_info(struct list_elem* pelem/*, int arg UNUSED*/) {
 	 pad_print(out_pad, 16, "DIED", 's');
    }
    pad_print(out_pad, 16, &pthread->elapsed_ticks, 'x');
+   pad_print(out_pad, 16, &pthread->min_flt, 'x');
+   pad_print(out_pad, 16, &pthread->maj_flt, 'x');
 
    memset(out_pad, 0, 16);
    ASSERT(strlen(pthread->name) < 17);
@@ -375,9 +519,67 @@ static bool elem2thread_info(struct list_elem* pelem/*, int arg UNUSED*/) {
 
  /* 打印任务列表 */
 void sys_ps(void) {
-   char* ps_title = "PID            PPID           STAT           TICKS          COMMAND\n";
+   char* ps_title = "PID            PPID           STAT           TICKS          MINFLT         MAJFLT         COMMAND\n";
    sys_write(stdout_no, ps_title, strlen(ps_title));
    list_traversal(&thread_all_list, elem2thread_info, 0);
 }
 
+#define CSWBENCH_ROUNDS 2000    // 每种配置下调用者与对端线程往返的次数, 每次往返切换两次
+
+static struct task_struct* bench_peer;  // 切换开销测试的对端内核线程
+static bool bench_running;              // 测试进行中时, 对端线程不断让出处理器
+
+// 对端线程平时阻塞, 测试时与调用者轮流让出处理器
+static void bench_peer_func(void* arg /*UNUSED*/) {
+    while (1) {
+        thread_block(TASK_BLOCKED);
+        while (bench_running) {
+            thread_yield();
+        }
+    }
+}
+
+// 按当前的 cr3 与全局页配置测一轮, 向标准输出写出每次切换的平均时钟周期数、纳秒数及 cr3 的加载情况
+static void bench_round(const char* name) {
+    uint32_t loads = cr3_loads, skips = cr3_skips;
+    bench_running = true;
+    thread_unblock(bench_peer);
+    uint64_t start_ns = ktime_ns();
+    uint64_t start = rdtsc();
+    uint32_t round = 0;
+    while (round++ < CSWBENCH_ROUNDS) {
+        thread_yield();
+    }
+    uint32_t cycles = (uint32_t)(rdtsc() - start);
+    uint32_t ns = (uint32_t)(ktime_ns() - start_ns);
+    bench_running = false;
+    // 等对端线程回到阻塞状态, 下一轮才能再唤醒它
+    while (bench_peer->status != TASK_BLOCKED) {
+        thread_yield();
+    }
+    printk_stdout("%s  %d  %d  %d  %d\n", name, cycles / (CSWBENCH_ROUNDS * 2), ns / (CSWBENCH_ROUNDS * 2), \
+                  cr3_loads - loads, cr3_skips - skips);
+}
+
+// 上下文切换开销测试: 调用者与一个内核线程来回切换, 对比每次都加载 cr3 与按需加载、有无全局页的开销
+void sys_cswbench(void) {
+    if (bench_peer == NULL) {
+        bench_peer = thread_start("cswbench", default_prio, bench_peer_func, NULL);
+        while (bench_peer->status != TASK_BLOCKED) {
+            thread_yield();
+        }
+    }
+    printk_stdout("MODE  CYCLES/SWITCH  NS/SWITCH  CR3_LOADS  CR3_SKIPS\n");
+    cr3_lazy = false;
+    if (global_pages_set(false)) {
+        bench_round("reload");
+        global_pages_set(true);
+    } else {
+        printk_stdout("global pages not supported\n");
+    }
+    bench_round("reload+global");
+    cr3_lazy = true;
+    bench_round("lazy+global");
+}
+
 
@@ -4,9 +4,11 @@
 #include "list.h"
 #include "memory.h"
 #include "bitmap.h"
+#include "vma.h"
 
 #define TASK_NAME_LEN 16
 #define MAX_FILES_OPEN_PER_PROC 8
+#define MLFQ_LEVELS 8           // 多级反馈队列的级数, 0 级最高
 
 // 自定义通用函数类型, 在线程函数中作为形参类型
 typedef void thread_func(void*);
@@ -76,8 +78,10 @@ struct task_struct {
     pid_t pid;
     enum task_status status;
     char name[16];
-    uint8_t priority;              // 线程优先级
-    uint8_t ticks;                 // 每次在处理器上执行的时间嘀嗒数
+    uint8_t priority;              // 线程优先级, 决定所能到达的最高级别
+    uint8_t ticks;                 // 本级时间片剩余的嘀嗒数
+    uint8_t level;                 // 所在的多级反馈队列级别, 用完时间片降级, 早早阻塞升级
+    uint8_t top_level;             // 由 priority 换算出的最高级别, 升级和定期提升都不超过它
     uint32_t elapsed_ticks;        // 此任务上 cpu 运行后至今占用了多少嘀嗒数
 
     int32_t fd_table[MAX_FILES_OPEN_PER_PROC];  // 文件描述符数组
@@ -86,15 +90,23 @@ struct task_struct {
     struct list_elem all_list_tag;  // 用于线程在 thread_all_list 中的结点
 
     uint32_t* pgdir;                // 进程自己页表的虚拟地址
-    struct virtual_addr userprog_vaddr; // 用户进程的虚拟地址
     struct mem_block_desc u_block_desc[DESC_CNT];   //用户进程内存块描述符
+    struct mem_magazine mags[DESC_CNT];             // 各规格内存块的弹匣
+    struct vm_area* vma_root;       // 用户地址空间中已占用的区域, 按地址排序的 AVL 树
+    uint32_t min_flt;               // 缺页时分配新页的次数
+    uint32_t maj_flt;               // 缺页时从交换分区换入的次数
+    uint32_t heap_start;            // brk 堆的起始地址
+    uint32_t heap_brk;              // brk 堆的当前末端
     uint32_t cwd_inode_nr;          // 进程所在工作目录的 inode 编号
+    struct uring_ctx* uring;        // 进程登记的提交/完成环, 没有为 NULL
+    struct task_struct* host;       // uring 工作线程代为操作文件的进程, 其余任务为 NULL
+    bool io_cancel;                 // 置位后在 ioq_getchar_intr 中的等待被取消, 只用于即将退出的任务
     int16_t parent_pid;             // 父进程 pid
     int8_t exit_status;             // 进程结束时自己调用 exit 传入的参数
     uint32_t stack_magic;           // 栈的边界标记, 用于检测栈的溢出
 };
-extern struct list thread_ready_list;
 extern struct list thread_all_list;
+extern struct kmem_cache* task_cache;
 
 void thread_create(struct task_struct* pthread, thread_func function, void* func_arg);
 void init_thread(struct task_struct* pthread, char* name, int prio);
@@ -104,7 +116,15 @@ void schedule(void);
 void thread_init(void);
 void thread_block(enum task_status stat);
 void thread_unblock(struct task_struct* pthread);
+void thread_ready_append(struct task_struct* pthread);
+void thread_tick(struct task_struct* cur, uint32_t elapsed);
+uint32_t thread_tick_budget(struct task_struct* cur);
 void thread_yield(void);
+void thread_exit(struct task_struct* thread_over, bool need_schedule);
+struct task_struct* pid2thread(int32_t pid);
+pid_t fork_pid(void);
+void release_pid(pid_t pid);
 void init(void);
 void sys_ps(void);
+void sys_cswbench(void);
 #endif
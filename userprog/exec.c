@@ -5,6 +5,7 @@
 #include "string.h"
 #include "global.h"
 #include "memory.h"
+#include "uring.h"
 
 extern void intr_exit(void);
 typedef uint32_t Elf32_Word, Elf32_Addr, Elf32_Off;
@@ -52,13 +53,14 @@ enum segment_type {
 };
 
 // 将文件描述符 fd 指向的文件中，偏移位 offset，大小为 filesz 的段加载到虚拟地址为 vaddr 的内存
-static bool segment_load(int32_t fd, uint32_t offset, uint32_t filesz, uint32_t vaddr) {
+// 段在内存中占 memsz 字节, 超出 filesz 的部分(.bss)清零
+static bool segment_load(int32_t fd, uint32_t offset, uint32_t filesz, uint32_t memsz, uint32_t vaddr) {
     uint32_t vaddr_first_page = vaddr & 0xfffff000; // vaddr 地址所在的页框
     uint32_t size_in_first_page = PG_SIZE - (vaddr & 0x00000fff);  // 加载到内存后，文件在第一个页框中占用的字节大小
     uint32_t occupy_pages = 0;
     // 若一个页框容不下该段
-    if (filesz > size_in_first_page) {
-        uint32_t left_size = filesz - size_in_first_page;
+    if (memsz > size_in_first_page) {
+        uint32_t left_size = memsz - size_in_first_page;
         occupy_pages = DIV_ROUND_UP(left_size, PG_SIZE) + 1;
     } else {
         occupy_pages = 1;
@@ -74,7 +76,8 @@ static bool segment_load(int32_t fd, uint32_t offset, uint32_t filesz, uint32_t
         // 如果 pde 不存在，或者 pte 不存在，就分配内存
         // pde 的 判断要在 pte 之前，否在 pde 若不存在会导致
         // 判断 pte 时缺页异常
-        if (!(*pde & 0x00000001) || !(*pte & 0x00000001)) {
+        // 已换出的页仍保存着前一段写入的内容, 不能另分配新页, 读入时由缺页处理换入
+        if (!(*pde & 0x00000001) || !(*pte & (PG_P_1 | PG_SWAP))) {
             if (get_a_page(PF_USER, vaddr_page) == NULL) {
                 return false;
             }
@@ -84,6 +87,9 @@ static bool segment_load(int32_t fd, uint32_t offset, uint32_t filesz, uint32_t
     }
     sys_lseek(fd, offset, SEEK_SET);
     sys_read(fd, (void*)vaddr, filesz);
+    if (memsz > filesz) {
+        memset((void*)(vaddr + filesz), 0, memsz - filesz);
+    }
     return true;
 }
 
@@ -134,7 +140,7 @@ static int32_t load(const char* pathname) {
 
         // 如果是可加载段就调用 segment_load 加载到内存
         if (PT_LOAD == prog_header.p_type) {
-            if (!segment_load(fd, prog_header.p_offset, prog_header.p_filesz, prog_header.p_vaddr)) {
+            if (!segment_load(fd, prog_header.p_offset, prog_header.p_filesz, prog_header.p_memsz, prog_header.p_vaddr)) {
                 ret = -1;
                 goto done;
             }
@@ -161,8 +167,12 @@ int32_t sys_execv(const char* path, const char* argv[]) {
     }
 
     struct task_struct* cur = running_thread();
+    // 旧程序登记的提交/完成环已被新映像覆盖
+    uring_release(cur);
     // 修改进程名
     memcpy(cur->name, path, TASK_NAME_LEN);
+    // 旧程序的 brk 堆不再使用, 全部归还
+    sys_brk((void*)cur->heap_start);
 
     // 修改栈中参数
     struct intr_stack* intr_0_stack = (struct intr_stack*)((uint32_t)cur + PG_SIZE - sizeof(struct intr_stack));
@@ -7,69 +7,37 @@
 #include "string.h"
 #include "file.h"
 #include "stdio.h"
+#include "slab.h"
+#include "vma.h"
 
 extern void intr_exit(void);
 
-// 将父进程的 pcb、虚拟地址位图拷贝给子进程
-static int32_t copy_pcb_vaddrbitmap_stack0(struct task_struct* child_thread, struct task_struct* parent_thread) {
+// 将父进程的 pcb、地址空间区域拷贝给子进程
+static int32_t copy_pcb_vma_stack0(struct task_struct* child_thread, struct task_struct* parent_thread) {
     // a 先复制 pcb 所在的整个页，里面包含进程 pcb 信息及特级 0，里面包含了返回地址，然后再单独修改个别属性
     memcpy(child_thread, parent_thread, PG_SIZE);
     child_thread->pid = fork_pid();
     child_thread->elapsed_ticks = 0;
     child_thread->status = TASK_READY;
-    child_thread->ticks = child_thread->priority;   // 为新进程把时间片充满
     child_thread->parent_pid = parent_thread->pid;
+    child_thread->uring = NULL;     // 提交/完成环不继承, 子进程需要时自己登记
     child_thread->general_tag.prev = child_thread->general_tag.next = NULL;
     child_thread->all_list_tag.prev = child_thread->all_list_tag.next = NULL;
-    block_desc_init(child_thread->u_block_desc);
-    // b 复制父进程的虚拟地址池的位图
-    uint32_t bitmap_pg_cnt = DIV_ROUND_UP((0xc0000000 - USER_VADDR_START) / PG_SIZE / 8, PG_SIZE);
-    void* vaddr_btmp = get_kernel_pages(bitmap_pg_cnt);
-    if (vaddr_btmp == NULL) return -1;
-    // 此时 child_thread->userprog_vaddr.vaddr_bitmap.bits 还是指向父进程虚拟地址的位图地址
-    // 下面将 child_thread->userprog_vaddr.vaddr_bitmap.bits 指向自己的位图 vaddr_btml
-    memcpy(vaddr_btmp, child_thread->userprog_vaddr.vaddr_bitmap.bits, bitmap_pg_cnt * PG_SIZE);
-    child_thread->userprog_vaddr.vaddr_bitmap.bits = vaddr_btmp;
+    // 子进程沿用父进程的内存块描述符: 继承来的 arena 中, 空闲块仍在复制来的 free_list 上, 与 arena 的计数一致
+    // free_list 的首尾节点还指向父进程的链表头尾, 由子进程第一次用到时改过来
+    uint8_t desc_idx;
+    for (desc_idx = 0; desc_idx < DESC_CNT; desc_idx++) {
+        child_thread->u_block_desc[desc_idx].inherited = true;
+    }
+    // b 复制父进程的区域树, 只复制实际存在的区域
+    // 此时 child_thread->vma_root 还指向父进程的区域树
+    if (!vma_copy(child_thread, parent_thread)) {
+        release_pid(child_thread->pid);
+        return -1;
+    }
     return 0;
 }   
 
-// 复制子进程的进程体（代码和数据）及用户栈
-static void copy_body_stack3(struct task_struct* child_thread, struct task_struct* parent_thread, void* buf_page) {
-    uint8_t* vaddr_btmp = parent_thread->userprog_vaddr.vaddr_bitmap.bits;
-    uint32_t btmp_bytes_len = parent_thread->userprog_vaddr.vaddr_bitmap.btmp_bytes_len;
-    uint32_t vaddr_start = parent_thread->userprog_vaddr.vaddr_start;
-    uint32_t idx_byte = 0;
-    uint32_t idx_bit = 0;
-    uint32_t prog_vaddr = 0;
-
-    // 在父进程的用户空间中查找已有数据的页
-    while (idx_byte < btmp_bytes_len) {
-        if (vaddr_btmp[idx_byte]) {
-            idx_bit = 0;
-            while (idx_bit < 8) {
-                if ((BITMAP_MASK << idx_bit) & vaddr_btmp[idx_byte]) {
-                    prog_vaddr = (idx_byte * 8 + idx_bit) * PG_SIZE + vaddr_start;
-                    // 下面的操作是将父进程用户空间的数据通过内核空间做中转，最终复制到子进程的用户空间
-                    
-                    // a 将父进程在用户空间中的数据复制到内核缓冲区 buf_page
-                    // 目的是下面切换到子进程的页表后，还能访问到父进程的数据
-                    memcpy(buf_page, (void*)prog_vaddr, PG_SIZE);
-                    // b 将页表切换到子进程，目的是避免下面申请内存的函数将 pte 及 pde 安装在父进程的页表中
-                    page_dir_activate(child_thread);
-                    // c 申请虚拟地址 prog_vaddr
-                    get_a_page_without_opvaddrbitmap(PF_USER, prog_vaddr);
-                    // d 匆匆内核缓冲区中将父进程数据复制到子进程的用户空间
-                    memcpy((void*)prog_vaddr, buf_page, PG_SIZE);
-                    // e 恢复父进程页表
-                    page_dir_activate(parent_thread);
-                }
-                idx_bit++;
-            }
-        }
-        idx_byte++;
-    }
-}
-
 // 为子进程构建 thread_stack 和修改返回值
 static int32_t build_child_stack(struct task_struct* child_thread) {
     // a 使子进程 pid 返回值为 0
@@ -101,51 +69,56 @@ static int32_t build_child_stack(struct task_struct* child_thread) {
 
 // 拷贝父进程本身所占资源给子进程
 static int32_t copy_process(struct task_struct* child_thread, struct task_struct* parent_thread) {
-    // 内核缓冲区，作为父进程用户空间的数据复制到子进程用户空间的中转
-    void* buf_page = get_kernel_pages(1);
-    if (buf_page == NULL) {
-        return -1;
-    }
-
-    // a 复制父进程的 pcb，虚拟地址位图，内核栈到子进程
-    if (copy_pcb_vaddrbitmap_stack0(child_thread, parent_thread) == -1) {
+    // a 复制父进程的 pcb，地址空间区域，内核栈到子进程
+    if (copy_pcb_vma_stack0(child_thread, parent_thread) == -1) {
         return -1;
     }
 
     // b 为子进程创建页表，此页表仅包括内核空间
     child_thread->pgdir = create_page_dir();
     if (child_thread->pgdir == NULL) {
-        return -1;
+        goto free_vma;
     }
     
-    // c 复制父进程进程体及用户栈给子进程
-    copy_body_stack3(child_thread, parent_thread, buf_page);
+    // c 父子进程以写时复制的方式共享进程体及用户栈，写入时才复制
+    if (!user_pages_share(child_thread->pgdir)) {
+        goto unshare;
+    }
 
     // d 构建子进程 thread_stack 和修改返回值 pid
     build_child_stack(child_thread);
 
     // e 更新文件 inode 的打开数
     update_inode_open_cnts(child_thread);
-
-    mfree_page(PF_KERNEL, buf_page, 1);
     return 0;
+
+    // 失败时按相反的顺序撤销, 子进程不留下任何资源
+unshare:
+    user_pages_unshare(child_thread);   // 连同区域树一起释放
+    mfree_page(PF_KERNEL, child_thread->pgdir, 1);
+    release_pid(child_thread->pid);
+    return -1;
+free_vma:
+    vma_release(child_thread);
+    release_pid(child_thread->pid);
+    return -1;
 }
 
 // fork 子进程，内核线程不可直接调用
 pid_t sys_fork(void) {
     struct task_struct* parent_thread = running_thread();
-    struct task_struct* child_thread = get_kernel_pages(1); // 为子进程创建 pcb(task_struct 结构)
+    struct task_struct* child_thread = kmem_cache_alloc(task_cache); // 为子进程创建 pcb(task_struct 结构)
     if (child_thread == NULL) {
         return -1;
     }
     ASSERT(INTR_OFF == intr_get_status() && parent_thread->pgdir != NULL);
    
     if (copy_process(child_thread, parent_thread) == -1) {
+        kmem_cache_free(task_cache, child_thread);
         return -1;
     }
     // 添加到就绪队列和所有线程队列，子进程由调试器安排运行
-    ASSERT(!elem_find(&thread_ready_list, &child_thread->general_tag));
-    list_append(&thread_ready_list, &child_thread->general_tag);
+    thread_ready_append(child_thread);   // 子进程继承父进程的级别, 时间片充满
     ASSERT(!elem_find(&thread_all_list, &child_thread->all_list_tag));
     list_append(&thread_all_list, &child_thread->all_list_tag);
    
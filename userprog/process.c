@@ -8,9 +8,16 @@
 #include "interrupt.h"
 #include "string.h"
 #include "console.h"
+#include "slab.h"
+#include "vma.h"
 
 extern void intr_exit(void);
 
+/* 把用户栈及其增长区登记为区域, 除栈顶一页外其中的页在首次访问时才分配 */
+static void reserve_stack_area(struct task_struct* cur) {
+   vma_add(cur, 0xc0000000 - USER_STACK_SIZE, 0xc0000000, VMA_STACK);
+}
+
 /* 构建用户进程初始上下文信息 */
 void start_process(void* filename_) {
    //while(1);
@@ -26,18 +33,27 @@ void start_process(void* filename_) {
    proc_stack->eip = function;	 // 待执行的用户程序地址
    proc_stack->cs = SELECTOR_U_CODE;
    proc_stack->eflags = (EFLAGS_IOPL_0 | EFLAGS_MBS | EFLAGS_IF_1);
+   reserve_stack_area(cur);
    proc_stack->esp = (void*)((uint32_t)get_a_page(PF_USER, USER_STACK3_VADDR) + PG_SIZE ) ;
    proc_stack->ss = SELECTOR_U_DATA; 
    asm volatile ("movl %0, %%esp; jmp intr_exit" : : "g" (proc_stack) : "memory");
 }
 
+bool cr3_lazy = true;    // 为 false 时每次调度都加载 cr3, 供切换开销的对比测试使用
+uint32_t cr3_loads;     // 调度时加载 cr3 的次数
+uint32_t cr3_skips;     // 调度时省去加载 cr3 的次数
+
 /* 激活页表 */
 void page_dir_activate(struct task_struct* p_thread) {
 /********************************************************
- * 执行此函数时,当前任务可能是线程。
- * 之所以对线程也要重新安装页表, 原因是上一次被调度的可能是进程,
- * 否则不恢复页表的话,线程就会使用进程的页表了。
+ * 所有页目录的内核部分都相同, 内核线程只访问内核空间, 因此沿用上一个任务的页目录即可,
+ * 切回同一个进程时页目录也没变, 这两种情况都不加载 cr3, 以免无谓地刷新 tlb。
+ * 被沿用的页目录在释放前由 page_dir_drop 换下。
  ********************************************************/
+   if (cr3_lazy && p_thread->pgdir == NULL) {
+      cr3_skips++;
+      return;
+   }
 
 /* 若为内核线程,需要重新填充页表为0x100000 */
    uint32_t pagedir_phy_addr = 0x100000;  // 默认为内核的页目录物理地址,也就是内核线程所用的页目录表
@@ -45,10 +61,27 @@ void page_dir_activate(struct task_struct* p_thread) {
       pagedir_phy_addr = addr_v2p((uint32_t)p_thread->pgdir);
    }
 
+   uint32_t cur_cr3;
+   asm volatile ("movl %%cr3, %0" : "=r" (cur_cr3));
+   if (cr3_lazy && cur_cr3 == pagedir_phy_addr) {
+      cr3_skips++;
+      return;
+   }
+
    /* 更新页目录寄存器cr3,使新页表生效 */
+   cr3_loads++;
    asm volatile ("movl %0, %%cr3" : : "r" (pagedir_phy_addr) : "memory");
 }
 
+/* 进程 p_thread 的页目录即将释放, 若内核线程还沿用着它, 就换回内核的页目录 */
+void page_dir_drop(struct task_struct* p_thread) {
+   uint32_t cur_cr3;
+   asm volatile ("movl %%cr3, %0" : "=r" (cur_cr3));
+   if (cur_cr3 == addr_v2p((uint32_t)p_thread->pgdir)) {
+      asm volatile ("movl %0, %%cr3" : : "r" (0x100000) : "memory");
+   }
+}
+
 /* 击活线程或进程的页表,更新tss中的esp0为进程的特权级0的栈 */
 void process_activate(struct task_struct* p_thread) {
    ASSERT(p_thread != NULL);
@@ -86,28 +119,18 @@ uint32_t* create_page_dir(void) {
    return page_dir_vaddr;
 }
 
-/* 创建用户进程虚拟地址位图 */
-void create_user_vaddr_bitmap(struct task_struct* user_prog) {
-   user_prog->userprog_vaddr.vaddr_start = USER_VADDR_START;
-   uint32_t bitmap_pg_cnt = DIV_ROUND_UP((0xc0000000 - USER_VADDR_START) / PG_SIZE / 8 , PG_SIZE);
-   user_prog->userprog_vaddr.vaddr_bitmap.bits = get_kernel_pages(bitmap_pg_cnt);
-   user_prog->userprog_vaddr.vaddr_bitmap.btmp_bytes_len = (0xc0000000 - USER_VADDR_START) / PG_SIZE / 8;
-   bitmap_init(&user_prog->userprog_vaddr.vaddr_bitmap);
-}
-
 /* 创建用户进程 */
 void process_execute(void* filename, char* name) { 
    /* pcb内核的数据结构,由内核来维护进程信息,因此要在内核内存池中申请 */
-   struct task_struct* thread = get_kernel_pages(1);
+   struct task_struct* thread = kmem_cache_alloc(task_cache);
    init_thread(thread, name, default_prio); 
-   create_user_vaddr_bitmap(thread);
    thread_create(thread, start_process, filename);
    thread->pgdir = create_page_dir();
    block_desc_init(thread->u_block_desc);
+   thread->heap_start = thread->heap_brk = USER_HEAP_START;
    
    enum intr_status old_status = intr_disable();
-   ASSERT(!elem_find(&thread_ready_list, &thread->general_tag));
-   list_append(&thread_ready_list, &thread->general_tag);
+   thread_ready_append(thread);
 
    ASSERT(!elem_find(&thread_all_list, &thread->all_list_tag));
    list_append(&thread_all_list, &thread->all_list_tag);
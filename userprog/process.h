@@ -5,10 +5,14 @@
 #define default_prio 31
 #define USER_STACK3_VADDR  (0xc0000000 - 0x1000)
 #define USER_VADDR_START 0x8048000
+#define USER_STACK_SIZE 0x800000   // 用户栈最大 8MB, 除栈顶一页外都按需分配
+#define USER_HEAP_START 0x40000000 // brk 堆的起始地址, 向上增长到栈增长区为止
 void process_execute(void* filename, char* name);
 void start_process(void* filename_);
 void process_activate(struct task_struct* p_thread);
 void page_dir_activate(struct task_struct* p_thread);
+void page_dir_drop(struct task_struct* p_thread);
+extern bool cr3_lazy;
+extern uint32_t cr3_loads, cr3_skips;
 uint32_t* create_page_dir(void);
-void create_user_vaddr_bitmap(struct task_struct* user_prog);
 #endif
\ No newline at end of file
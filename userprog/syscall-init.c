@@ -11,10 +11,16 @@
 #include "exec.h"
 #include "wait_exit.h"
 #include "pipe.h"
+#include "slab.h"
+#include "swap.h"
+#include "timer.h"
+#include "uring.h"
 
-#define syscall_nr 32   // 最大支持的系统子功能调用数
+#define syscall_nr 48   // 最大支持的系统子功能调用数
 typedef void* syscall;
 syscall syscall_table[syscall_nr];
+// 子功能号超出 syscall_table 时 syscall_init 会越界写, 编译时就报错
+_Static_assert(SYS_CNT <= syscall_nr, "syscall_nr is smaller than the number of syscalls");
 
 // 返回当前任务的 pid
 uint32_t sys_getpid(void) {
@@ -58,5 +64,15 @@ void syscall_init(void) {
     syscall_table[SYS_PIPE]	    = sys_pipe;
     syscall_table[SYS_FD_REDIRECT]   = sys_fd_redirect;
     syscall_table[SYS_HELP]	    = sys_help;
+    syscall_table[SYS_BRK]      = sys_brk;
+    syscall_table[SYS_MEMINFO]  = sys_meminfo;
+    syscall_table[SYS_SLABINFO] = sys_slabinfo;
+    syscall_table[SYS_CSWBENCH] = sys_cswbench;
+    syscall_table[SYS_ZRAMCAP]  = sys_zram_cap;
+    syscall_table[SYS_NANOSLEEP] = sys_nanosleep;
+    syscall_table[SYS_TIMERSTAT] = sys_timerstat;
+    syscall_table[SYS_CLOCK_GETTIME] = sys_clock_gettime;
+    syscall_table[SYS_URING_SETUP] = sys_uring_setup;
+    syscall_table[SYS_URING_ENTER] = sys_uring_enter;
     put_str("syscall_init done\n");
 }
\ No newline at end of file
@@ -3,6 +3,15 @@
 #include "global.h"
 #include "string.h"
 #include "print.h"
+#include "io.h"
+#include "vdata.h"
+
+#define CPUID_SEP (1 << 11)                 // cpuid 1 号功能 edx 中表示支持 sysenter/sysexit 的位
+#define MSR_SYSENTER_CS 0x174               // sysenter 进入内核时的代码段, 栈段为其后一个描述符
+#define MSR_SYSENTER_ESP 0x175              // sysenter 进入内核时的栈指针
+#define MSR_SYSENTER_EIP 0x176              // sysenter 进入内核后执行的地址
+
+extern void sysenter_entry(void);
 
 // 任务状态段 tss 结构
 struct tss {
@@ -57,6 +66,23 @@ static struct gdt_desc make_gdt_desc(uint32_t* desc_addr,
     return desc;
 }
 
+// 处理器支持时设置 sysenter 用到的 MSR, 并在共享数据页中告知用户程序
+// sysenter 只能从 MSR 取固定的栈指针, 这里让它指向 tss.esp0 字段本身, 由 sysenter_entry 从中读出当前任务的 0 级栈
+static void sysenter_init(void) {
+    uint32_t eax = 1, ebx, ecx, edx;
+    asm volatile ("cpuid" : "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx));
+    // 早期的 Pentium Pro 虽置了 SEP 位却不支持这两条指令
+    uint32_t family = (eax >> 8) & 0xf, model = (eax >> 4) & 0xf, stepping = eax & 0xf;
+    if (!(edx & CPUID_SEP) || (family == 6 && model < 3 && stepping < 3)) {
+        put_str("sysenter not supported, use int 0x80\n");
+        return;
+    }
+    wrmsr(MSR_SYSENTER_CS, SELECTOR_SYSENTER_CS);
+    wrmsr(MSR_SYSENTER_ESP, (uint32_t)&tss.esp0);
+    wrmsr(MSR_SYSENTER_EIP, (uint32_t)sysenter_entry);
+    vdata->sysenter = 1;
+}
+
 // 在 gdt 中创建 tss 并重新加载 gdt
 void tss_init() {
     put_str("tss_init start\n");
@@ -71,10 +97,16 @@ void tss_init() {
     // 在 gdt 中添加 dpl 为 3 的数据段和代码段描述符
     *((struct gdt_desc*)0xc0000928) = make_gdt_desc((uint32_t*)0, 0xfffff, GDT_CODE_ATTR_LOW_DPL3, GDT_ATTR_HIGH);
     *((struct gdt_desc*)0xc0000930) = make_gdt_desc((uint32_t*)0, 0xfffff, GDT_DATA_ATTR_LOW_DPL3, GDT_ATTR_HIGH);
+    // sysenter/sysexit 按 MSR 中的选择子推算其余三个段, 为它们另建一组相邻的平坦段描述符
+    *((struct gdt_desc*)0xc0000938) = make_gdt_desc((uint32_t*)0, 0xfffff, GDT_CODE_ATTR_LOW_DPL0, GDT_ATTR_HIGH);
+    *((struct gdt_desc*)0xc0000940) = make_gdt_desc((uint32_t*)0, 0xfffff, GDT_DATA_ATTR_LOW_DPL0, GDT_ATTR_HIGH);
+    *((struct gdt_desc*)0xc0000948) = make_gdt_desc((uint32_t*)0, 0xfffff, GDT_CODE_ATTR_LOW_DPL3, GDT_ATTR_HIGH);
+    *((struct gdt_desc*)0xc0000950) = make_gdt_desc((uint32_t*)0, 0xfffff, GDT_DATA_ATTR_LOW_DPL3, GDT_ATTR_HIGH);
 
     // gdt 16 位的 limit 32 位的段基址
-    uint64_t gdt_operand = ((8 * 7 - 1) | ((uint64_t)(uint32_t)0xc0000900 << 16));
+    uint64_t gdt_operand = ((8 * 11 - 1) | ((uint64_t)(uint32_t)0xc0000900 << 16));
     asm volatile ("lgdt %0" : : "m" (gdt_operand));
     asm volatile ("ltr %w0" : : "r" (SELECTOR_TSS));
+    sysenter_init();
     put_str("tss_init and ltr done\n");
 }
\ No newline at end of file
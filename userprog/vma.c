@@ -0,0 +1,269 @@
+#include "vma.h"
+#include "stdint.h"
+#include "global.h"
+#include "debug.h"
+#include "thread.h"
+#include "slab.h"
+#include "string.h"
+
+// 区域互不重叠, 因此按起始地址排序的 AVL 树即可按地址查找区域
+// 查找、插入和删除都是 O(log n), 树的深度很小, 递归不会撑爆内核栈
+
+static struct kmem_cache* vma_cache;
+
+#define PG_SIZE 4096
+
+static int32_t vma_height(struct vm_area* node) {
+    return node == NULL ? 0 : node->height;
+}
+
+// 根据左右子树更新 node 的高度
+static void vma_update(struct vm_area* node) {
+    int32_t lh = vma_height(node->left);
+    int32_t rh = vma_height(node->right);
+    node->height = (lh > rh ? lh : rh) + 1;
+}
+
+static struct vm_area* rotate_right(struct vm_area* node) {
+    struct vm_area* top = node->left;
+    node->left = top->right;
+    top->right = node;
+    vma_update(node);
+    vma_update(top);
+    return top;
+}
+
+static struct vm_area* rotate_left(struct vm_area* node) {
+    struct vm_area* top = node->right;
+    node->right = top->left;
+    top->left = node;
+    vma_update(node);
+    vma_update(top);
+    return top;
+}
+
+// 恢复以 node 为根的子树的平衡, 返回新的子树根
+static struct vm_area* rebalance(struct vm_area* node) {
+    vma_update(node);
+    int32_t balance = vma_height(node->left) - vma_height(node->right);
+    if (balance > 1) {
+        if (vma_height(node->left->left) < vma_height(node->left->right)) {
+            node->left = rotate_left(node->left);
+        }
+        return rotate_right(node);
+    }
+    if (balance < -1) {
+        if (vma_height(node->right->right) < vma_height(node->right->left)) {
+            node->right = rotate_right(node->right);
+        }
+        return rotate_left(node);
+    }
+    return node;
+}
+
+static struct vm_area* tree_insert(struct vm_area* root, struct vm_area* node) {
+    if (root == NULL) {
+        return node;
+    }
+    if (node->start < root->start) {
+        root->left = tree_insert(root->left, node);
+    } else {
+        root->right = tree_insert(root->right, node);
+    }
+    return rebalance(root);
+}
+
+// 摘下子树中起始地址最小的节点存入 *min, 返回新的子树根
+static struct vm_area* tree_remove_min(struct vm_area* root, struct vm_area** min) {
+    if (root->left == NULL) {
+        *min = root;
+        return root->right;
+    }
+    root->left = tree_remove_min(root->left, min);
+    return rebalance(root);
+}
+
+// 摘下起始地址为 start 的节点存入 *removed, 返回新的子树根
+static struct vm_area* tree_remove(struct vm_area* root, uint32_t start, struct vm_area** removed) {
+    if (root == NULL) {
+        return NULL;
+    }
+    if (start < root->start) {
+        root->left = tree_remove(root->left, start, removed);
+    } else if (start > root->start) {
+        root->right = tree_remove(root->right, start, removed);
+    } else {
+        *removed = root;
+        if (root->left == NULL) {
+            return root->right;
+        }
+        if (root->right == NULL) {
+            return root->left;
+        }
+        struct vm_area* succ;
+        struct vm_area* right = tree_remove_min(root->right, &succ);
+        succ->left = root->left;
+        succ->right = right;
+        return rebalance(succ);
+    }
+    return rebalance(root);
+}
+
+// 返回起始地址不大于 vaddr 的最后一个区域
+static struct vm_area* vma_floor(struct vm_area* node, uint32_t vaddr) {
+    struct vm_area* found = NULL;
+    while (node != NULL) {
+        if (node->start <= vaddr) {
+            found = node;
+            node = node->right;
+        } else {
+            node = node->left;
+        }
+    }
+    return found;
+}
+
+// 返回起始地址不小于 vaddr 的第一个区域
+static struct vm_area* vma_ceil(struct vm_area* node, uint32_t vaddr) {
+    struct vm_area* found = NULL;
+    while (node != NULL) {
+        if (node->start >= vaddr) {
+            found = node;
+            node = node->left;
+        } else {
+            node = node->right;
+        }
+    }
+    return found;
+}
+
+// 返回进程 pthread 中起始地址不小于 vaddr 的第一个区域, 用于按地址顺序遍历所有区域
+struct vm_area* vma_next(struct task_struct* pthread, uint32_t vaddr) {
+    return vma_ceil(pthread->vma_root, vaddr);
+}
+
+// 为进程 pthread 登记区域 [start, end), 与已有区域重叠或内存不足时返回 false
+bool vma_add(struct task_struct* pthread, uint32_t start, uint32_t end, enum vma_type type) {
+    ASSERT(start < end && (start & 0xfff) == 0 && (end & 0xfff) == 0);
+    if (vma_intersect(pthread, start, end) != NULL) {
+        return false;
+    }
+    struct vm_area* vma = kmem_cache_alloc(vma_cache);
+    if (vma == NULL) {
+        return false;
+    }
+    vma->start = start;
+    vma->end = end;
+    vma->type = type;
+    memset(&vma->arena, 0, sizeof(struct arena));
+    vma->left = vma->right = NULL;
+    vma->height = 1;
+    pthread->vma_root = tree_insert(pthread->vma_root, vma);
+    return true;
+}
+
+// 注销进程 pthread 中起始地址为 start 的区域, 不存在则什么也不做
+void vma_remove(struct task_struct* pthread, uint32_t start) {
+    struct vm_area* removed = NULL;
+    pthread->vma_root = tree_remove(pthread->vma_root, start, &removed);
+    if (removed != NULL) {
+        kmem_cache_free(vma_cache, removed);
+    }
+}
+
+// 返回进程 pthread 中包含 vaddr 的区域, 找不到返回 NULL
+struct vm_area* vma_find(struct task_struct* pthread, uint32_t vaddr) {
+    struct vm_area* vma = vma_floor(pthread->vma_root, vaddr);
+    if (vma != NULL && vaddr < vma->end) {
+        return vma;
+    }
+    return NULL;
+}
+
+// 返回进程 pthread 中与 [start, end) 相交的起始地址最大的区域, 没有相交的返回 NULL
+struct vm_area* vma_intersect(struct task_struct* pthread, uint32_t start, uint32_t end) {
+    struct vm_area* vma = vma_floor(pthread->vma_root, end - 1);
+    if (vma != NULL && vma->end > start) {
+        return vma;
+    }
+    return NULL;
+}
+
+// 在 [low, high) 中为进程 pthread 找出首个能容纳 len 字节的空闲地址, 找不到返回 0
+uint32_t vma_get_unmapped(struct task_struct* pthread, uint32_t len, uint32_t low, uint32_t high) {
+    uint32_t addr = low;
+    struct vm_area* vma = vma_floor(pthread->vma_root, addr);
+    if (vma != NULL && vma->end > addr) {
+        addr = vma->end;
+    }
+    // 按地址顺序跳过各区域, 检查区域之间的空隙
+    while (addr < high && high - addr >= len) {
+        vma = vma_ceil(pthread->vma_root, addr);
+        if (vma == NULL || vma->start - addr >= len) {
+            return addr;
+        }
+        addr = vma->end;
+    }
+    return 0;
+}
+
+// 为固定地址 vaddr 所在的页登记区域, 已在某个区域中则什么也不做
+// 紧接在程序映像区域之后的页并入该区域, 以免为每页建一个节点
+bool vma_reserve_page(struct task_struct* pthread, uint32_t vaddr) {
+    vaddr &= 0xfffff000;
+    if (vma_find(pthread, vaddr) != NULL) {
+        return true;
+    }
+    struct vm_area* prev = vma_floor(pthread->vma_root, vaddr);
+    if (prev != NULL && prev->type == VMA_IMAGE && prev->end == vaddr) {
+        prev->end += PG_SIZE;
+        return true;
+    }
+    return vma_add(pthread, vaddr, vaddr + PG_SIZE, VMA_IMAGE);
+}
+
+// 复制以 src 为根的子树, 保持原有形状, 内存不足时 *ok 置为 false
+static struct vm_area* tree_clone(struct vm_area* src, bool* ok) {
+    if (src == NULL || !*ok) {
+        return NULL;
+    }
+    struct vm_area* node = kmem_cache_alloc(vma_cache);
+    if (node == NULL) {
+        *ok = false;
+        return NULL;
+    }
+    *node = *src;
+    node->left = tree_clone(src->left, ok);
+    node->right = tree_clone(src->right, ok);
+    return node;
+}
+
+// 把父进程 parent 的所有区域复制给子进程 child, 失败时 child 不持有任何区域
+bool vma_copy(struct task_struct* child, struct task_struct* parent) {
+    bool ok = true;
+    child->vma_root = tree_clone(parent->vma_root, &ok);
+    if (!ok) {
+        vma_release(child);
+    }
+    return ok;
+}
+
+static void tree_release(struct vm_area* node) {
+    if (node == NULL) {
+        return;
+    }
+    tree_release(node->left);
+    tree_release(node->right);
+    kmem_cache_free(vma_cache, node);
+}
+
+// 释放进程 pthread 的所有区域
+void vma_release(struct task_struct* pthread) {
+    tree_release(pthread->vma_root);
+    pthread->vma_root = NULL;
+}
+
+// 创建区域节点的对象缓存, 需在对象缓存初始化之后调用
+void vma_init(void) {
+    vma_cache = kmem_cache_create("vm_area", sizeof(struct vm_area), 0, NULL);
+}
@@ -0,0 +1,38 @@
+#ifndef __USERPROG_VMA_H
+#define __USERPROG_VMA_H
+#include "stdint.h"
+#include "global.h"
+#include "memory.h"
+
+// 区域的用途
+enum vma_type {
+    VMA_IMAGE,  // 程序映像等固定地址的页, 相邻的页合并为一个区域
+    VMA_HEAP,   // sys_malloc 等从地址空间中挑选的页
+    VMA_STACK,  // 用户栈及其增长区
+    VMA_BRK     // brk 扩展出的进程堆
+};
+
+// 用户地址空间中已占用的区域 [start, end), 按 start 组织成 AVL 树
+// 区域内尚未映射的页在首次访问时才分配物理页
+struct vm_area {
+    uint32_t start;     // 起始地址, 页对齐
+    uint32_t end;       // 结束地址, 页对齐
+    enum vma_type type;
+    struct arena arena;     // sys_malloc 在本区域中的页外 arena, base 为 0 表示没有
+    struct vm_area* left;   // 起始地址更小的区域
+    struct vm_area* right;  // 起始地址更大的区域
+    int32_t height;         // 以本节点为根的子树高度
+};
+
+struct task_struct;
+void vma_init(void);
+bool vma_add(struct task_struct* pthread, uint32_t start, uint32_t end, enum vma_type type);
+void vma_remove(struct task_struct* pthread, uint32_t start);
+struct vm_area* vma_find(struct task_struct* pthread, uint32_t vaddr);
+struct vm_area* vma_next(struct task_struct* pthread, uint32_t vaddr);
+struct vm_area* vma_intersect(struct task_struct* pthread, uint32_t start, uint32_t end);
+uint32_t vma_get_unmapped(struct task_struct* pthread, uint32_t len, uint32_t low, uint32_t high);
+bool vma_reserve_page(struct task_struct* pthread, uint32_t vaddr);
+bool vma_copy(struct task_struct* child, struct task_struct* parent);
+void vma_release(struct task_struct* pthread);
+#endif
@@ -9,52 +9,18 @@
 #include "fs.h"
 #include "file.h"
 #include "pipe.h"
+#include "uring.h"
 
 // 释放用户进程资源
-// 1 页表中对应的物理页
-// 2 虚拟内存池占物理页框
-// 3 关闭打开的文件
+// 0 登记的提交/完成环及其工作线程
+// 1 页表中对应的物理页、交换槽及地址空间区域树的节点
+// 2 关闭打开的文件
 static void release_prog_resource(struct task_struct* release_thread) {
-    uint32_t* pgdir_vaddr = release_thread->pgdir;
-    uint16_t user_pde_nr = 768, pde_idx = 0;
-    uint32_t pde = 0;
-    uint32_t* v_pde_ptr = NULL;     // v 表示 var，和函数 pde_ptr 区分
-
-    uint16_t user_pte_nr = 1024, pte_idx = 0;
-    uint32_t pte = 0;
-    uint32_t* v_pte_ptr = NULL;      // v 表示 var，和函数 pte_ptr 区分
-
-    uint32_t* first_pte_vaddr_in_pde = NULL;    // 用来记录 pde 中第 0 个 pte 的地址
-    uint32_t pg_phy_addr = 0;
-
-    // 回收页表中用户空间的页框
-    while (pde_idx < user_pde_nr) {
-        v_pde_ptr = pgdir_vaddr + pde_idx;
-        pde = *v_pde_ptr;
-        if (pde & 0x00000001) {     // 如果页目录项 p 位为1，表示该页目录项下可能又页表项
-            first_pte_vaddr_in_pde = pte_ptr(pde_idx * 0x400000);   // 一个页表表示的内存容量是 4M，即 0x400000
-            pte_idx = 0;
-            while (pte_idx < user_pte_nr) {
-                v_pte_ptr = first_pte_vaddr_in_pde + pte_idx;
-                pte = *v_pte_ptr;
-                if (pte & 0x00000001) {
-                    // 将 pte 中记录的物理页框直接在相应内存池的位图中清 0
-                    pg_phy_addr = pte & 0xfffff000;
-                    free_a_phy_page(pg_phy_addr);
-                }
-                pte_idx++;
-            }
-            // 将 pde 中记录的物理页框直接在相应内存池的位图中清 0
-            pg_phy_addr = pde & 0xfffff000;
-            free_a_phy_page(pg_phy_addr);
-        }
-        pde_idx++;
-    }
+    // 先停下代进程操作文件的 uring 工作线程
+    uring_release(release_thread);
 
-    // 回收用户虚拟地址池所占的物理内存
-    uint32_t bitmap_pg_cnt = (release_thread->userprog_vaddr.vaddr_bitmap.btmp_bytes_len) / PG_SIZE;
-    uint8_t* user_vaddr_pool_bitmap = release_thread->userprog_vaddr.vaddr_bitmap.bits;
-    mfree_page(PF_KERNEL, user_vaddr_pool_bitmap, bitmap_pg_cnt);
+    // 按地址空间区域回收用户空间的页框和交换槽, 再回收区域树和页表本身
+    user_pages_release(release_thread);
 
     // 关闭进程打开的文件
     uint8_t local_fd = 3;
@@ -122,7 +88,7 @@ pid_t sys_wait(int32_t* status) {
             uint16_t child_pid = child_thread->pid;
 
             // 2 从就绪队列和全部队列中删除进程表项
-            thread_exit(child_thread->pid, false);  // 传入 false，使 thread_exit 调用后回到此处
+            thread_exit(child_thread, false);  // 传入 false，使 thread_exit 调用后回到此处
             // 进程表项使进程或线程的最后保留资源，至此该进程彻底消失了
 
             return child_pid;